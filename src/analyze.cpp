@@ -0,0 +1,340 @@
+#include "spear.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "man.h"
+#include "runner.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+struct HeaderCost {
+    std::set<path> sources;     // units including it, directly or through other headers
+    size_t bytes = 0;           // bytes of preprocessed output from it and the headers it includes, over the units
+    double parse_ms = 0;        // -ftime-trace parse time, the headers it includes too
+};
+
+static string read_file(path const& file) {
+    std::ifstream in(file, std::ios::binary);
+    return string(std::istreambuf_iterator<char>(in), {});
+}
+
+// one name per header, whichever way it was reached (gcc adds ../ to its own paths)
+static path header_key(path const& file, path const& dir) {
+    static std::map<path, path> keys;
+    path full = file.is_absolute() ? file : dir / file;
+    auto found = keys.find(full);
+    if (found != keys.end())
+        return found->second;
+    return keys[full] = fs::weakly_canonical(full);
+}
+
+// the directories the compiler searches for <headers>, after the -I ones
+static vector<path> compiler_include_dirs() {
+    vector<path> dirs;
+    auto process = runner::spawn({cc, "-E", "-x", "c++", "-v", "/dev/null"}, runner::Output::capture);
+    if (!process || runner::wait(*process) != 0)
+        return dirs;
+
+    std::stringstream lines(process->output);
+    string line;
+    bool in_list = false;
+    while (getline(lines, line)) {
+        if (line.starts_with("#include <...> search starts here:"))
+            in_list = true;
+        else if (line.starts_with("End of search list."))
+            break;
+        else if (in_list)
+            dirs.push_back(line.substr(line.find_first_not_of(' ')));
+    }
+    return dirs;
+}
+
+static vector<path> include_dirs(strvec const& args, path const& src_dir) {
+    vector<path> dirs;
+    for (size_t i = 0; i < args.size(); i++) {
+        for (string flag: {"-I", "-iquote", "-isystem"}) {
+            if (args[i] == flag && i + 1 < args.size())
+                dirs.push_back(src_dir / args[++i]);
+            else if (args[i].starts_with(flag) && args[i].size() > flag.size())
+                dirs.push_back(src_dir / args[i].substr(flag.size()));
+        }
+    }
+
+    auto system_dirs = compiler_include_dirs();
+    dirs.insert(dirs.end(), system_dirs.begin(), system_dirs.end());
+    return dirs;
+}
+
+// the headers a file includes, found like newer_header finds the local ones then in the
+// include directories. The conditions around the #include lines are not evaluated.
+static vector<path> const& included_by(path const& file, vector<path> const& search_dirs) {
+    static std::map<path, vector<path>> headers;
+    auto found = headers.find(file);
+    if (found != headers.end())
+        return found->second;
+
+    vector<path> included;
+    for (auto const& include: scan_includes(file)) {
+        vector<path> candidates;
+        if (!include.system)
+            candidates.push_back(file.parent_path() / include.name);
+        for (auto const& dir: search_dirs)
+            candidates.push_back(dir / include.name);
+
+        for (auto const& candidate: candidates) {
+            if (fs::is_regular_file(candidate)) {
+                included.push_back(header_key(candidate, {}));
+                break;
+            }
+        }
+    }
+    return headers[file] = included;
+}
+
+static void scan_unit(path const& file, vector<path> const& search_dirs, std::set<path>& seen) {
+    for (auto const& header: included_by(file, search_dirs)) {
+        if (seen.insert(header).second)
+            scan_unit(header, search_dirs, seen);
+    }
+}
+
+// the bytes of the preprocessed output coming from each file and the files it includes, like
+// the parse times of -ftime-trace. The line markers (# <line> "<file>" <flags>) enter a file
+// with flag 1 and return to the including one with flag 2, a marker without either moves in
+// the current file (or names the first one).
+static std::map<path, size_t> preprocessed_sizes(path const& preprocessed, path const& src_dir) {
+    struct Frame {
+        path file;      // empty for <built-in> and <command-line>
+        size_t bytes;
+    };
+    std::map<path, size_t> sizes;
+    vector<Frame> stack;
+    auto leave = [&]() {
+        Frame done = stack.back();
+        stack.pop_back();
+        if (!done.file.empty())
+            sizes[done.file] += done.bytes;
+        if (!stack.empty())
+            stack.back().bytes += done.bytes;
+    };
+
+    std::ifstream in(preprocessed);
+    string line;
+    while (getline(in, line)) {
+        if (!line.starts_with("# ") || line.size() < 3 || !isdigit(line[2])) {
+            if (!stack.empty())
+                stack.back().bytes += line.size() + 1;
+            continue;
+        }
+
+        size_t open = line.find('"');
+        size_t close = line.find('"', open + 1);
+        if (open == string::npos || close == string::npos)
+            continue;
+        string name = line.substr(open + 1, close - open - 1);
+        path file = name.starts_with("<") ? path() : header_key(name, src_dir);
+
+        std::stringstream flags(line.substr(close + 1));
+        int flag = 0;
+        flags >> flag;
+        if (flag == 1)
+            stack.push_back({file, 0});
+        else if (flag == 2) {
+            while (stack.size() > 1 && stack.back().file != file)
+                leave();
+            if (stack.empty() || stack.back().file != file)
+                stack = {{file, 0}};
+        }
+        else if (stack.empty())
+            stack.push_back({file, 0});
+        else if (stack.back().file != file) {
+            // gcc starts with the source, <built-in> and <command-line> one after the other
+            if (!stack.back().file.empty())
+                sizes[stack.back().file] += stack.back().bytes;
+            stack.back() = {file, 0};
+        }
+    }
+    while (!stack.empty())
+        leave();
+    return sizes;
+}
+
+// the "Source" events of a clang -ftime-trace file, in ms per header
+static std::map<path, double> parse_times(path const& trace, path const& src_dir) {
+    static const std::regex source_event("\"dur\":([0-9]+),\"name\":\"Source\",\"args\":\\{\"detail\":\"((?:[^\"\\\\]|\\\\.)*)\"");
+
+    std::map<path, double> times;
+    string data = read_file(trace);
+    for (std::sregex_iterator itr(data.begin(), data.end(), source_event), end; itr != end; itr++)
+        times[header_key((*itr)[2].str(), src_dir)] += std::stod((*itr)[1].str()) / 1000;
+    return times;
+}
+
+static string size_string(size_t bytes) {
+    std::stringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (bytes >= 1024 * 1024)
+        out << bytes / (1024.0 * 1024) << " MiB";
+    else
+        out << bytes / 1024.0 << " KiB";
+    return out.str();
+}
+
+// headers of the project are shown from its root
+static string display(path const& file) {
+    path relative = file.lexically_relative(root);
+    return !relative.empty() && *relative.begin() != ".." ? relative.string() : file.string();
+}
+
+static void analyze_includes(Profile const& profile, size_t top) {
+    path target_dir = make_target_dir(profile.name);
+    path src_dir = root / "src";
+    path work_dir = target_dir / "analyze";
+    fs::create_directories(work_dir);
+
+    auto units = compile_units(src_dir, target_dir / "object", profile_args(profile), target_dir / "bmi").units;
+    fs::current_path(root);
+    if (units.empty()) {
+        std::cout << "Error: no source in " << src_dir.string() << std::endl;
+        return;
+    }
+
+    std::cout << "ANALYZING " << units.size() << " sources" << std::endl;
+    std::map<path, HeaderCost> costs;
+    std::set<path> sources;
+    vector<path> search_dirs = include_dirs(units[0].args, src_dir);
+    for (auto const& unit: units)
+        sources.insert(header_key(unit.src_file, src_dir));
+
+    for (auto const& unit: units) {
+        path source = header_key(unit.src_file, src_dir);
+        std::set<path> seen;
+        scan_unit(source, search_dirs, seen);
+        for (auto const& header: seen)
+            costs[header].sources.insert(unit.src_file.lexically_normal());
+    }
+
+    // each unit is preprocessed, and compiled with -ftime-trace by clang, in batches of
+    // the job count. The objects and traces go to the analyze directory.
+    bool trace = is_clang();
+    for (size_t batch = 0; batch < units.size(); batch += jobs) {
+        vector<std::pair<size_t, runner::Process>> running;
+        for (size_t i = batch; i < std::min(units.size(), batch + jobs); i++) {
+            strvec preprocess = units[i].args;
+            auto output = std::find(preprocess.begin(), preprocess.end(), "-o");
+            *(output + 1) = work_dir / (std::to_string(i) + ".ii");
+            std::replace(preprocess.begin(), preprocess.end(), string("-c"), string("-E"));
+
+            if (auto process = runner::spawn(preprocess, runner::Output::capture, src_dir))
+                running.push_back({i, std::move(*process)});
+
+            if (!trace)
+                continue;
+            strvec compile = units[i].args;
+            *(std::find(compile.begin(), compile.end(), "-o") + 1) = work_dir / (std::to_string(i) + ".o");
+            compile.push_back("-ftime-trace");
+            if (auto process = runner::spawn(compile, runner::Output::capture, src_dir))
+                running.push_back({i, std::move(*process)});
+        }
+
+        for (auto& [i, process]: running) {
+            if (runner::wait(process) != 0)
+                std::cout << "Warning: could not analyze " << units[i].src_file.string() << ", its sizes are left out" << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < units.size(); i++) {
+        path source = units[i].src_file.lexically_normal();
+        for (auto const& [file, size]: preprocessed_sizes(work_dir / (std::to_string(i) + ".ii"), src_dir)) {
+            if (sources.count(file))
+                continue;
+            costs[file].bytes += size;
+            costs[file].sources.insert(source);
+        }
+        if (!trace)
+            continue;
+        for (auto const& [file, ms]: parse_times(work_dir / (std::to_string(i) + ".json"), src_dir)) {
+            if (sources.count(file))
+                continue;
+            costs[file].parse_ms += ms;
+            costs[file].sources.insert(source);
+        }
+    }
+    fs::remove_all(work_dir);
+
+    // the parse time is the cost when clang measured it, the preprocessed size otherwise
+    vector<std::pair<path, HeaderCost>> ranked(costs.begin(), costs.end());
+    std::sort(ranked.begin(), ranked.end(), [trace](auto const& a, auto const& b) {
+        if (trace && a.second.parse_ms != b.second.parse_ms)
+            return a.second.parse_ms > b.second.parse_ms;
+        if (a.second.bytes != b.second.bytes)
+            return a.second.bytes > b.second.bytes;
+        return a.second.sources.size() > b.second.sources.size();
+    });
+
+    std::cout << std::left << std::setw(60) << "HEADER" << std::setw(9) << "SOURCES" << std::setw(12) << "SIZE" << "PARSE" << std::endl;
+    for (size_t i = 0; i < std::min(top, ranked.size()); i++) {
+        auto const& [header, cost] = ranked[i];
+        std::stringstream parse;
+        if (trace)
+            parse << std::fixed << std::setprecision(1) << cost.parse_ms << " ms";
+        else
+            parse << "-";
+
+        std::cout << std::left << std::setw(60) << display(header) << std::setw(9) << cost.sources.size()
+                  << std::setw(12) << size_string(cost.bytes) << parse.str() << std::endl;
+
+        std::cout << "    from";
+        size_t shown = 0;
+        for (auto const& source: cost.sources) {
+            if (shown++ == 5) {
+                std::cout << " and " << cost.sources.size() - 5 << " more";
+                break;
+            }
+            std::cout << " " << source.string();
+        }
+        std::cout << std::endl;
+    }
+
+    if (!trace)
+        std::cout << "parse times need clang (-ftime-trace), headers are ranked by preprocessed size" << std::endl;
+}
+
+void analyze(const int argc, char* argv[]) {
+    CHECK((argc < 2 || string(argv[1]) != "includes"), man::analyze)
+
+    string name = "debug";
+    size_t top = 20;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--top") {
+            string count = i + 1 < argc ? argv[++i] : "";
+            auto parsed = std::from_chars(count.data(), count.data() + count.size(), top);
+            CHECK((count.empty() || parsed.ec != std::errc() || parsed.ptr != count.data() + count.size() || top == 0), man::analyze)
+        }
+        else
+            name = arg;
+    }
+
+    auto profile = find_profile(name);
+    if (!profile) {
+        std::cout << "Error: unknown profile '" << name << "'" << std::endl;
+        exit(1);
+    }
+    analyze_includes(*profile, top);
+}
@@ -0,0 +1,276 @@
+#include "spear.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include "toml/toml.h"
+#include "man.h"
+#include "runner.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+// one run of a benchmark: wall and cpu time in microseconds, peak rss in KiB
+struct Sample {
+    double wall;
+    double cpu;
+    double rss;
+};
+
+// median with its 95% confidence interval
+struct Stat {
+    double median;
+    double low;
+    double high;
+};
+
+struct BenchResult {
+    string name;
+    size_t runs;
+    Stat wall;
+    Stat cpu;
+    Stat rss;
+};
+
+static std::optional<Sample> run_sample(path const& executable) {
+    auto const start = std::chrono::steady_clock::now();
+
+    // keep the benchmark output from drowning the report
+    auto process = runner::spawn({executable}, runner::Output::discard);
+    if (!process)
+        return std::nullopt;
+
+    struct rusage usage;
+    int status = runner::wait(*process, &usage);
+    auto const end = std::chrono::steady_clock::now();
+    if (status != 0)
+        return std::nullopt;
+
+    auto to_us = [](struct timeval const& tv) { return tv.tv_sec * 1e6 + tv.tv_usec; };
+    return Sample{
+        std::chrono::duration<double, std::micro>(end - start).count(),
+        to_us(usage.ru_utime) + to_us(usage.ru_stime),
+        (double)usage.ru_maxrss,
+    };
+}
+
+static Stat summarize(vector<double> values) {
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+
+    double median = n % 2
+        ? values[n / 2]
+        : (values[n / 2 - 1] + values[n / 2]) / 2;
+
+    // distribution free interval from the order statistics (1-based ranks)
+    const double spread = 0.98 * std::sqrt((double)n);
+    long low_rank = std::max(1l, (long)std::floor(n / 2.0 - spread));
+    long high_rank = std::min((long)n, (long)std::ceil(1 + n / 2.0 + spread));
+
+    return {median, values[low_rank - 1], values[high_rank - 1]};
+}
+
+// toml table keys only accept [a-zA-Z0-9_]
+static string table_key(string name) {
+    for (auto& c: name) {
+        if (!std::isalnum((unsigned char)c) && c != '_')
+            c = '_';
+    }
+    if (name.empty() || std::isdigit((unsigned char)name[0]))
+        name = "_" + name;
+    return name;
+}
+
+static std::optional<BenchResult> measure(path const& executable, size_t warmup, size_t runs) {
+    for (size_t i = 0; i < warmup; i++) {
+        if (!run_sample(executable))
+            return std::nullopt;
+    }
+
+    vector<double> wall, cpu, rss;
+    for (size_t i = 0; i < runs; i++) {
+        auto sample = run_sample(executable);
+        if (!sample)
+            return std::nullopt;
+
+        wall.push_back(sample->wall);
+        cpu.push_back(sample->cpu);
+        rss.push_back(sample->rss);
+    }
+
+    return BenchResult{executable.filename(), runs, summarize(wall), summarize(cpu), summarize(rss)};
+}
+
+static void write_results(path const& file, vector<BenchResult> const& results) {
+    fs::create_directories(file.parent_path());
+    std::ofstream out(file);
+
+    auto write_stat = [&out](string const& metric, Stat const& stat) {
+        out << metric << "_median = " << std::llround(stat.median) << "\n"
+            << metric << "_low = " << std::llround(stat.low) << "\n"
+            << metric << "_high = " << std::llround(stat.high) << "\n";
+    };
+
+    for (auto const& result: results) {
+        out << "[" << table_key(result.name) << "]\n"
+            << "name = '" << result.name << "'\n"
+            << "runs = " << result.runs << "\n";
+        write_stat("wall", result.wall);
+        write_stat("cpu", result.cpu);
+        write_stat("rss", result.rss);
+        out << "\n";
+    }
+}
+
+static std::optional<BenchResult> read_result(toml::Table& saved, string const& name) {
+    string key = table_key(name);
+    if (!saved.contains(key))
+        return std::nullopt;
+
+    auto number = [&saved, &key](string const& field) {
+        auto node = saved[key + "." + field];
+        return node.has_value() && node.value()->is("Number")
+            ? node.value()->as<toml::Number>()->_data
+            : 0.0;
+    };
+    auto stat = [&number](string const& metric) {
+        return Stat{number(metric + "_median"), number(metric + "_low"), number(metric + "_high")};
+    };
+
+    return BenchResult{name, (size_t)number("runs"), stat("wall"), stat("cpu"), stat("rss")};
+}
+
+static string format_stat(Stat const& stat, string const& unit) {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(0)
+       << stat.median << " " << unit << " [" << stat.low << ", " << stat.high << "]";
+    return os.str();
+}
+
+// a metric regresses when it moved past the threshold and both intervals no longer overlap
+static bool compare_stat(string const& metric, Stat const& current, Stat const& baseline, double threshold) {
+    if (baseline.median <= 0)
+        return false;
+
+    double change = (current.median - baseline.median) / baseline.median * 100;
+    std::cout << "    " << std::left << std::setw(5) << metric
+              << std::showpos << std::fixed << std::setprecision(1) << change << "%" << std::noshowpos;
+
+    bool regression = change > threshold && current.low > baseline.high;
+    if (regression)
+        std::cout << "  REGRESSION";
+    else if (change < -threshold && current.high < baseline.low)
+        std::cout << "  improvement";
+    std::cout << std::endl;
+
+    return regression;
+}
+
+void bench(const int argc, char* argv[]) {
+    string filter;
+    string save_name;
+    string baseline_name;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--save" && i + 1 < argc)
+            save_name = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline_name = argv[++i];
+        else if (arg.starts_with("--")) {
+            std::cout << man::bench << std::endl;
+            return;
+        }
+        else
+            filter = arg;
+    }
+
+    if (!fs::exists(root / "bench")) {
+        std::cout << "Error: no bench/ directory in " << root.string() << std::endl;
+        return;
+    }
+
+    const size_t warmup = std::max(0.0, settings.bench.warmup);
+    const size_t runs = std::max(1.0, settings.bench.runs);
+    const double threshold = settings.bench.threshold;
+
+    auto executables = build_programs(*find_profile("release"), root / "bench", "bench");
+
+    std::cout << "BENCHMARKING" << std::endl;
+    vector<BenchResult> results;
+    strvec failed;
+    for (auto const& executable: executables) {
+        string name = path(executable).filename();
+        if (!filter.empty() && name.find(filter) == string::npos)
+            continue;
+
+        auto result = measure(executable, warmup, runs);
+        if (!result) {
+            std::cout << name << ": failed" << std::endl;
+            failed.push_back(name);
+            continue;
+        }
+
+        std::cout << name << "\n"
+                  << "    wall " << format_stat(result->wall, "us") << "\n"
+                  << "    cpu  " << format_stat(result->cpu, "us") << "\n"
+                  << "    rss  " << format_stat(result->rss, "KiB") << std::endl;
+        results.push_back(*result);
+    }
+
+    path results_dir = target_root / "bench";
+    write_results(results_dir / "last.toml", results);
+    if (!save_name.empty())
+        write_results(results_dir / (save_name + ".toml"), results);
+
+    // a benchmark that did not run fails the command, it is missing from the results
+    if (!failed.empty()) {
+        std::cout << "Error: could not run";
+        for (auto const& name: failed)
+            std::cout << " " << name;
+        std::cout << std::endl;
+    }
+
+    if (baseline_name.empty()) {
+        if (!failed.empty())
+            exit(1);
+        return;
+    }
+
+    path baseline_file = results_dir / (baseline_name + ".toml");
+    if (!fs::exists(baseline_file)) {
+        std::cout << "Error: no baseline named '" << baseline_name << "' in " << results_dir.string() << std::endl;
+        exit(1);
+    }
+
+    std::cout << "COMPARING against " << baseline_name << std::endl;
+    toml::Table saved = toml::parse(baseline_file);
+    bool regression = false;
+    for (auto const& result: results) {
+        auto baseline = read_result(saved, result.name);
+        if (!baseline) {
+            std::cout << result.name << ": not in baseline" << std::endl;
+            continue;
+        }
+
+        std::cout << result.name << std::endl;
+        regression |= compare_stat("wall", result.wall, baseline->wall, threshold);
+        regression |= compare_stat("cpu", result.cpu, baseline->cpu, threshold);
+        regression |= compare_stat("rss", result.rss, baseline->rss, threshold);
+    }
+
+    if (regression || !failed.empty())
+        exit(1);
+}
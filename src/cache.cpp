@@ -0,0 +1,438 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "man.h"
+#include "runner.h"
+#include "spear.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+namespace cache {
+
+static string read_file(path const& file) {
+    std::ifstream in(file, std::ios::binary);
+    return string(std::istreambuf_iterator<char>(in), {});
+}
+
+// fnv-1a, enough to tell signatures apart and catch truncated or corrupted artifacts
+struct Hash {
+    uint64_t value = 14695981039346656037ull;
+
+    void add(string const& data) {
+        for (unsigned char c: data) {
+            value ^= c;
+            value *= 1099511628211ull;
+        }
+        value ^= 0xff;
+        value *= 1099511628211ull;
+    }
+
+    string hex() const {
+        std::stringstream out;
+        out << std::hex;
+        out.width(16);
+        out.fill('0');
+        out << value;
+        return out.str();
+    }
+};
+
+// the --version output and the installed compiler file: a rebuilt or updated compiler with
+// the same version string has another size or time
+static string compiler_identity() {
+    static string identity;
+    if (!identity.empty())
+        return identity;
+
+    auto process = runner::spawn({cc, "--version"}, runner::Output::capture);
+    if (process && runner::wait(*process) == 0)
+        identity = process->output;
+
+    path compiler = cc.find('/') == string::npos ? find_program(cc) : path(cc);
+    std::error_code error;
+    path file = fs::canonical(compiler, error);
+    if (!error) {
+        identity += file.string() + " " + std::to_string(fs::file_size(file, error)) + " "
+            + std::to_string(fs::last_write_time(file, error).time_since_epoch().count());
+    }
+    return identity;
+}
+
+// checkouts in different places share the same signature
+static void replace_root(string& text) {
+    string root_dir = root.string();
+    for (size_t pos = text.find(root_dir); pos != string::npos; pos = text.find(root_dir, pos + 1))
+        text.replace(pos, root_dir.size(), ".");
+}
+
+// the key hashes the preprocessed unit: every header it reads (local, dependency and system
+// ones) is in it, whichever -I found it. The stale units preprocess jobs at a time.
+vector<string> keys(vector<std::pair<path, strvec>> const& units, path const& work_dir) {
+    vector<string> found(units.size());
+    fs::create_directories(work_dir);
+
+    for (size_t batch = 0; batch < units.size(); batch += jobs) {
+        vector<std::pair<size_t, runner::Process>> running;
+        for (size_t i = batch; i < std::min(units.size(), batch + jobs); i++) {
+            strvec preprocess = units[i].second;
+            auto output = std::find(preprocess.begin(), preprocess.end(), "-o");
+            if (output == preprocess.end() || output + 1 == preprocess.end())
+                continue;
+            *(output + 1) = work_dir / (std::to_string(i) + ".ii");
+            std::replace(preprocess.begin(), preprocess.end(), string("-c"), string("-E"));
+
+            if (auto process = runner::spawn(preprocess, runner::Output::capture))
+                running.push_back({i, std::move(*process)});
+        }
+
+        for (auto& [i, process]: running) {
+            path preprocessed_file = work_dir / (std::to_string(i) + ".ii");
+            if (runner::wait(process) == 0) {
+                Hash hash;
+                hash.add(compiler_identity());
+                for (auto arg: units[i].second) {
+                    replace_root(arg);
+                    hash.add(arg);
+                }
+                string preprocessed = read_file(preprocessed_file);
+                replace_root(preprocessed);
+                hash.add(preprocessed);
+                found[i] = hash.hex();
+            }
+            fs::remove(preprocessed_file);
+        }
+    }
+    return found;
+}
+
+bool pack(vector<path> const& files, path const& artifact) {
+    fs::create_directories(artifact.parent_path());
+    std::ofstream out(artifact, std::ios::binary);
+    out << "spear-cache " << files.size() << "\n";
+    for (auto const& file: files) {
+        string data = read_file(file);
+        Hash hash;
+        hash.add(data);
+        out << data.size() << " " << hash.hex() << "\n" << data;
+    }
+    return bool(out);
+}
+
+bool restore(path const& artifact, vector<path> const& files) {
+    std::ifstream in(artifact, std::ios::binary);
+    string magic;
+    size_t count;
+    if (!(in >> magic >> count) || magic != "spear-cache" || in.get() != '\n' || count != files.size())
+        return false;
+
+    vector<string> contents;
+    for (size_t i = 0; i < count; i++) {
+        size_t size;
+        string expected_hash;
+        if (!(in >> size >> expected_hash) || in.get() != '\n')
+            return false;
+
+        string data(size, '\0');
+        in.read(data.data(), size);
+        Hash hash;
+        hash.add(data);
+        if (size_t(in.gcount()) != size || hash.hex() != expected_hash) {
+            std::cout << "Warning: corrupted cache artifact " << artifact.filename().string() << ", compiling it" << std::endl;
+            return false;
+        }
+        contents.push_back(std::move(data));
+    }
+
+    // renamed in place so an interrupted restore never leaves half a file
+    for (size_t i = 0; i < count; i++) {
+        path tmp = files[i];
+        tmp += ".tmp";
+        std::ofstream(tmp, std::ios::binary) << contents[i];
+        fs::rename(tmp, files[i]);
+    }
+    return true;
+}
+
+// a local or network (nfs) directory, <dir>/<key>
+struct DirectoryBackend: Backend {
+    path dir;
+
+    DirectoryBackend(path dir): dir(std::move(dir)) {}
+
+    // a few threads, the copies mostly wait on the file system
+    template<class F>
+    void for_each(vector<Entry> const& entries, F copy) {
+        size_t workers = std::min<size_t>(entries.size(), 8);
+        vector<std::thread> threads;
+        for (size_t worker = 0; worker < workers; worker++) {
+            threads.emplace_back([&, worker]() {
+                for (size_t i = worker; i < entries.size(); i += workers)
+                    copy(entries[i]);
+            });
+        }
+        for (auto& thread: threads)
+            thread.join();
+    }
+
+    void get(vector<Entry> const& entries) override {
+        for_each(entries, [this](Entry const& entry) {
+            std::error_code error;
+            fs::copy_file(dir / entry.key, entry.file, fs::copy_options::overwrite_existing, error);
+        });
+    }
+
+    void put(vector<Entry> const& entries) override {
+        std::error_code error;
+        fs::create_directories(dir, error);
+        for_each(entries, [this](Entry const& entry) {
+            std::error_code error;
+            path tmp = dir / (entry.key + "." + std::to_string(getpid()) + ".tmp");
+            if (fs::copy_file(entry.file, tmp, fs::copy_options::overwrite_existing, error))
+                fs::rename(tmp, dir / entry.key, error);
+        });
+    }
+};
+
+// GET/PUT <url>/<key>, one curl process transfers all the entries in parallel
+struct HttpBackend: Backend {
+    string url;
+
+    HttpBackend(string url): url(std::move(url)) {}
+
+    bool transfer(vector<Entry> const& entries, string const& file_option) {
+        if (entries.empty())
+            return true;
+
+        // the transfers go in a curl config file, a command line would overflow on big trees
+        path config = entries.front().file.parent_path() / ("." + file_option + ".curl");
+        std::ofstream out(config);
+        for (auto const& entry: entries)
+            out << "url = \"" << url << "/" << entry.key << "\"\n" << file_option << " = \"" << entry.file.string() << "\"\n";
+        out.close();
+
+        auto process = runner::spawn({"curl", "--silent", "--no-progress-meter", "--fail", "--parallel", "--parallel-max", "16", "--config", config}, runner::Output::discard);
+        int status = process ? runner::wait(*process) : -1;
+        fs::remove(config);
+
+        // 22 is a missing entry, 7 an unreachable server
+        if (status == 7 || status < 0)
+            std::cout << "Warning: cache " << url << " is unreachable" << std::endl;
+        return status == 0;
+    }
+
+    void get(vector<Entry> const& entries) override {
+        transfer(entries, "output");
+    }
+
+    void put(vector<Entry> const& entries) override {
+        transfer(entries, "upload-file");
+    }
+};
+
+std::unique_ptr<Backend> open() {
+    string url = settings.cache.url;
+    if (url.empty())
+        return nullptr;
+
+    if (url.starts_with("http://") || url.starts_with("https://")) {
+        while (url.ends_with("/"))
+            url.pop_back();
+        return std::make_unique<HttpBackend>(url);
+    }
+    if (url.starts_with("file://"))
+        url.erase(0, strlen("file://"));
+    return std::make_unique<DirectoryBackend>(url);
+}
+
+bool writable() {
+    return settings.cache.mode != "read-only";
+}
+
+static bool valid_key(string const& key) {
+    return !key.empty() && key.find_first_not_of("0123456789abcdef") == string::npos;
+}
+
+static void respond(int client, string const& status, string const& body = "") {
+    string response = "HTTP/1.1 " + status + "\r\nContent-Length: " + std::to_string(body.size())
+        + "\r\nConnection: close\r\n\r\n" + body;
+    for (size_t sent = 0; sent < response.size();) {
+        ssize_t size = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (size <= 0)
+            return;
+        sent += size;
+    }
+}
+
+static void handle(int client, path const& dir) {
+    string request;
+    char buffer[65536];
+    size_t header_end;
+    while ((header_end = request.find("\r\n\r\n")) == string::npos) {
+        ssize_t size = recv(client, buffer, sizeof(buffer), 0);
+        if (size <= 0)
+            return;
+        request.append(buffer, size);
+    }
+
+    std::stringstream headers(request.substr(0, header_end));
+    string method, target, line;
+    headers >> method >> target;
+    getline(headers, line);
+
+    size_t content_length = 0;
+    bool expect_continue = false;
+    bool valid_length = true;
+    while (getline(headers, line)) {
+        string lower = line;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if (lower.starts_with("content-length:")) {
+            // a client sending anything but a number gets a 400, not a dead server
+            size_t begin = line.find_first_not_of(" \t", strlen("content-length:"));
+            size_t end = line.find_last_not_of(" \t\r") + 1;
+            auto parsed = begin < end ? std::from_chars(line.data() + begin, line.data() + end, content_length) : std::from_chars_result{line.data(), std::errc::invalid_argument};
+            valid_length = parsed.ec == std::errc() && parsed.ptr == line.data() + end;
+        }
+        else if (lower.starts_with("expect:") && lower.find("100-continue") != string::npos)
+            expect_continue = true;
+    }
+
+    string key = target.substr(target.find_last_of('/') + 1);
+    if (!target.starts_with("/") || !valid_key(key) || !valid_length) {
+        respond(client, "400 Bad Request");
+        std::cout << method << " " << target << " 400" << std::endl;
+        return;
+    }
+
+    string status;
+    if (method == "GET") {
+        path file = dir / key;
+        status = fs::exists(file) ? "200 OK" : "404 Not Found";
+        respond(client, status, fs::exists(file) ? read_file(file) : "");
+    }
+    else if (method == "PUT") {
+        if (expect_continue) {
+            string go_on = "HTTP/1.1 100 Continue\r\n\r\n";
+            send(client, go_on.data(), go_on.size(), MSG_NOSIGNAL);
+        }
+
+        string body = request.substr(header_end + 4);
+        while (body.size() < content_length) {
+            ssize_t size = recv(client, buffer, sizeof(buffer), 0);
+            if (size <= 0)
+                return;
+            body.append(buffer, size);
+        }
+
+        path tmp = dir / (key + ".tmp");
+        std::ofstream(tmp, std::ios::binary) << body;
+        fs::rename(tmp, dir / key);
+        status = "201 Created";
+        respond(client, status);
+    }
+    else {
+        status = "405 Method Not Allowed";
+        respond(client, status);
+    }
+    std::cout << method << " " << key << " " << status.substr(0, 3) << std::endl;
+}
+
+std::optional<std::pair<string, int>> listen_address(string const& listen, int default_port) {
+    if (listen.empty())
+        return std::pair<string, int>{"localhost", default_port};
+
+    size_t colon = listen.find_last_of(':');
+    if (colon != string::npos && listen.find(']', colon) != string::npos)
+        colon = string::npos;
+    string address = colon == string::npos ? "localhost" : listen.substr(0, colon);
+    if (address.size() > 1 && address.front() == '[' && address.back() == ']')
+        address = address.substr(1, address.size() - 2);
+
+    string port = listen.substr(colon == string::npos ? 0 : colon + 1);
+    int number = 0;
+    auto parsed = std::from_chars(port.data(), port.data() + port.size(), number);
+    if (address.empty() || parsed.ec != std::errc() || parsed.ptr != port.data() + port.size() || number <= 0 || number > 65535)
+        return std::nullopt;
+    return std::pair<string, int>{address, number};
+}
+
+int listen_socket(string const& address, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* found;
+    if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) {
+        std::cout << "Error: unknown address " << address << std::endl;
+        return -1;
+    }
+
+    // :: takes the ipv4 clients too
+    int server = -1;
+    for (addrinfo* info = found; info && server < 0; info = info->ai_next) {
+        server = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        int reuse = 1, v6_only = 0;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (info->ai_family == AF_INET6)
+            setsockopt(server, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only));
+        if (server >= 0 && (bind(server, info->ai_addr, info->ai_addrlen) < 0 || listen(server, 64) < 0)) {
+            close(server);
+            server = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return server;
+}
+
+void serve(path const& dir, string const& address, int port) {
+    fs::create_directories(dir);
+
+    int server = listen_socket(address, port);
+    if (server < 0) {
+        perror("spear cache serve");
+        return;
+    }
+
+    std::cout << "serving " << dir.string() << " on " << address << " port " << port << std::endl;
+    while (true) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0)
+            continue;
+        handle(client, dir);
+        close(client);
+    }
+}
+
+}
+
+void cache_command(const int argc, char* argv[]) {
+    CHECK((argc < 3 || string(argv[1]) != "serve"), man::cache)
+
+    // the PUT requests are not authenticated, the server listens on localhost unless told otherwise
+    string listen;
+    for (int i = 3; i < argc; i++) {
+        CHECK((string(argv[i]) != "--listen" || i + 1 >= argc), man::cache)
+        listen = argv[++i];
+    }
+    auto address = cache::listen_address(listen, 8090);
+    CHECK((!address), man::cache)
+    cache::serve(argv[2], address->first, address->second);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// shared build cache: objects are stored under a key made of their compile signature
+// (compiler, flags and preprocessed source) so every machine compiling the same
+// unit can reuse them. Configured by [cache] in spear.toml or the global spear.toml.
+namespace cache {
+
+struct Entry {
+    std::string key;
+    std::filesystem::path file;     // local copy of the artifact
+};
+
+struct Backend {
+    virtual ~Backend() = default;
+    // downloads the artifacts at once, the missing ones leave no file
+    virtual void get(std::vector<Entry> const& entries) = 0;
+    virtual void put(std::vector<Entry> const& entries) = 0;
+};
+
+// the backend of [cache] url (a directory or an http:// server), nullptr without cache
+std::unique_ptr<Backend> open();
+// [cache] mode = 'read-only' only downloads
+bool writable();
+
+// the keys of the units (source, compile args), empty for a unit that does not preprocess.
+// The preprocessed files are written in work_dir.
+std::vector<std::string> keys(std::vector<std::pair<std::filesystem::path, std::vector<std::string>>> const& units, std::filesystem::path const& work_dir);
+// an artifact holds the outputs of a compile (object, .dwo) each with its size and hash,
+// checked on restore
+bool pack(std::vector<std::filesystem::path> const& files, std::filesystem::path const& artifact);
+bool restore(std::filesystem::path const& artifact, std::vector<std::filesystem::path> const& files);
+
+// the address and port of a [[address:]port] argument (an ipv6 address in brackets),
+// localhost when no address is given, nullopt when it is invalid
+std::optional<std::pair<std::string, int>> listen_address(std::string const& listen, int default_port);
+// a socket listening on address:port (:: or 0.0.0.0 for every interface), -1 when it fails
+int listen_socket(std::string const& address, int port);
+
+// minimal http server storing the artifacts PUT in dir, for tests and small teams
+void serve(std::filesystem::path const& dir, std::string const& address, int port);
+
+}
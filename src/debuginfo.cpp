@@ -0,0 +1,82 @@
+#include "spear.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+void add_debug_info_options(Profile& profile) {
+    // the .dwo files stay next to the objects, the linker does not copy their debug info
+    if (settings.debug.split) {
+        profile.options.push_back("-gsplit-dwarf");
+        // the binutils dwp packing the .dwo at install time only reads dwarf 4
+        if (!is_clang())
+            profile.options.push_back("-gdwarf-4");
+        profile.link_options.push_back("-gsplit-dwarf");
+    }
+
+    // gdb reads the index instead of scanning every unit when it loads the binary,
+    // bfd cannot build it
+    string linker = select_linker();
+    if (settings.debug.gdb_index && (linker == "gold" || linker == "lld" || linker == "mold")) {
+        profile.options.push_back("-ggnu-pubnames");
+        profile.link_options.push_back("-Wl,--gdb-index");
+    }
+
+    string compress = settings.debug.compress;
+    if (compress != "none") {
+        profile.options.push_back("-gz=" + compress);
+        profile.link_options.push_back("-gz=" + compress);
+    }
+}
+
+bool has_split_dwarf(strvec const& args) {
+    return std::find(args.begin(), args.end(), "-gsplit-dwarf") != args.end();
+}
+
+path dwo_file(path const& object) {
+    return path(object).replace_extension(".dwo");
+}
+
+// copies binary in dir stripped, its debug info goes to dir/.debug/<name>.debug where gdb
+// finds it through the debug link, the .dwo of a split dwarf build are packed in <name>.dwp
+bool install_binary(path const& binary, path const& object_dir, path const& dir) {
+    path installed = dir / binary.filename();
+    path debug_dir = dir / ".debug";
+    path debug_file = debug_dir / (binary.filename().string() + ".debug");
+    fs::create_directories(debug_dir);
+    fs::copy_file(binary, installed, fs::copy_options::overwrite_existing);
+
+    if (!execute({"objcopy", "--only-keep-debug", installed, debug_file}))
+        return false;
+
+    // the debug link is looked up relative to the binary, the command runs next to it
+    fs::current_path(dir);
+    bool stripped = execute({"objcopy", "--strip-all", "--add-gnu-debuglink=" + fs::relative(debug_file, dir).string(), installed});
+    fs::current_path(root);
+    if (!stripped)
+        return false;
+
+    bool split = false;
+    if (fs::exists(object_dir)) {
+        for (auto const& entry: fs::recursive_directory_iterator{object_dir})
+            split |= entry.path().extension() == ".dwo";
+    }
+    if (!split)
+        return true;
+
+    // the .dwo paths are relative to the compile directory
+    path dwp = installed;
+    dwp += ".dwp";
+    fs::current_path(root / "src");
+    bool packed = execute({"dwp", "-e", binary, "-o", dwp});
+    fs::current_path(root);
+    return packed;
+}
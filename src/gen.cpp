@@ -0,0 +1,258 @@
+#include "spear.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "man.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+// the words of a command line for sh
+static string shell_quote(string const& arg) {
+    if (!arg.empty() && arg.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+=/.,:@%") == string::npos)
+        return arg;
+
+    string quoted = "'";
+    for (char c: arg)
+        quoted += c == '\'' ? string("'\\''") : string(1, c);
+    return quoted + "'";
+}
+
+static string shell_command(strvec const& cmd) {
+    string line;
+    for (auto const& arg: cmd)
+        line += (line.empty() ? "" : " ") + shell_quote(arg);
+    return line;
+}
+
+// ninja reads '$' as a variable, and spaces and ':' as separators in build lines
+static string ninja_escape(string const& text, bool path = false) {
+    string escaped;
+    for (char c: text) {
+        if (c == '$' || (path && (c == ' ' || c == ':')))
+            escaped += '$';
+        escaped += c;
+    }
+    return escaped;
+}
+
+// build lines name the files from the directory of build.ninja, ninja -C <dir> only finds
+// the build.ninja edge regenerating the manifest under that name
+static string ninja_path(path const& file, path const& dir) {
+    return ninja_escape(fs::absolute(file).lexically_normal().lexically_relative(dir).string(), true);
+}
+
+static string ninja_paths(vector<path> const& paths, path const& dir) {
+    string line;
+    for (auto const& file: paths)
+        line += " " + ninja_path(file, dir);
+    return line;
+}
+
+static string json_escape(string const& text) {
+    string escaped;
+    for (char c: text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else if (c == '\t')
+            escaped += "\\t";
+        else
+            escaped += c;
+    }
+    return '"' + escaped + '"';
+}
+
+// a file is only rewritten when its content changed. An unchanged one is touched as ninja
+// would otherwise run the generator again on every build.
+static void write_generated(path const& file, string const& content) {
+    std::ifstream previous(file, std::ios::binary);
+    if (previous && string(std::istreambuf_iterator<char>(previous), {}) == content) {
+        fs::last_write_time(file, fs::file_time_type::clock::now());
+        std::cout << file.string() << " is up to date" << std::endl;
+        return;
+    }
+    previous.close();
+
+    std::ofstream(file, std::ios::binary) << content;
+    std::cout << "GENERATED " << file.string() << std::endl;
+}
+
+// the compile commands of spear build <profile>, with the headers each unit depends on
+struct Graph {
+    path src_dir;
+    path object_dir;
+    path bmi_dir;
+    path output;
+    vector<CompileUnit> units;
+    std::map<string, size_t> interfaces;
+    vector<vector<path>> headers;
+};
+
+static Graph build_graph(Profile const& profile) {
+    path target_dir = make_target_dir(profile.name);
+
+    Graph graph;
+    graph.src_dir = root / "src";
+    graph.object_dir = target_dir / "object";
+    graph.bmi_dir = target_dir / "bmi";
+    graph.output = target_dir / "build" / project_name;
+
+    auto found = compile_units(graph.src_dir, graph.object_dir, profile_args(profile), graph.bmi_dir);
+    graph.units = std::move(found.units);
+    graph.interfaces = std::move(found.interfaces);
+    for (auto const& unit: graph.units) {
+        vector<path> headers;
+        for (auto const& header: local_headers(unit.src_file)) {
+            if (fs::exists(header))
+                headers.push_back(fs::absolute(header).lexically_normal());
+        }
+        graph.headers.push_back(headers);
+    }
+
+    fs::current_path(root);
+    return graph;
+}
+
+static void gen_ninja(Profile const& profile) {
+    Graph graph = build_graph(profile);
+    path ninja_dir = fs::absolute(target_root / profile.name).lexically_normal();
+    path ninja_file = ninja_dir / "build.ninja";
+    if (spear_executable().empty()) {
+        std::cout << "Error: spear is not in PATH, build.ninja could not run spear gen ninja" << std::endl;
+        exit(1);
+    }
+
+    std::stringstream out;
+    out << "# the commands of spear build " << profile.name << ", regenerated by spear gen ninja when\n"
+        << "# spear.toml or the source files change\n"
+        << "ninja_required_version = 1.7\n\n"
+        << "rule compile\n"
+        << "  command = cd $dir && $cmd\n"
+        << "  description = BUILDING $in\n\n"
+        << "rule archive\n"
+        << "  command = rm -f $out && $cmd\n"
+        << "  description = ARCHIVING $out\n\n"
+        << "rule link\n"
+        << "  command = $cmd\n"
+        << "  description = LINKING $out\n\n"
+        << "rule spear\n"
+        << "  command = cd " << ninja_escape(shell_quote(root.string())) << " && "
+        << ninja_escape(shell_command({spear_executable(), "gen", "ninja", profile.name})) << "\n"
+        << "  description = GENERATING $out\n"
+        << "  generator = 1\n"
+        << "  restat = 1\n\n";
+
+    strvec objects;
+    for (size_t i = 0; i < graph.units.size(); i++) {
+        CompileUnit const& unit = graph.units[i];
+        objects.push_back(unit.object);
+
+        // module interfaces come out with their unit and are inputs of the units importing them
+        vector<path> outputs;
+        if (!unit.modules.provides.empty())
+            outputs.push_back(module_interface(graph.bmi_dir, unit.modules.provides));
+        if (has_split_dwarf(unit.args))
+            outputs.push_back(dwo_file(unit.object));
+
+        vector<path> inputs = graph.headers[i];
+        for (auto const& module: unit.modules.imports) {
+            if (graph.interfaces.count(module) && graph.interfaces[module] != i)
+                inputs.push_back(module_interface(graph.bmi_dir, module));
+        }
+
+        out << "build " << ninja_path(unit.object, ninja_dir)
+            << (outputs.empty() ? "" : " |" + ninja_paths(outputs, ninja_dir)) << ": compile"
+            << ninja_paths({graph.src_dir / unit.src_file}, ninja_dir)
+            << (inputs.empty() ? "" : " |" + ninja_paths(inputs, ninja_dir)) << "\n"
+            << "  dir = " << ninja_escape(shell_quote(graph.src_dir.string())) << "\n"
+            << "  cmd = " << ninja_escape(shell_command(unit.args)) << "\n";
+    }
+    out << "\n";
+
+    auto link = link_commands(graph.object_dir, objects, graph.output, profile.link_options);
+    for (auto const& archive: link.archives) {
+        out << "build " << ninja_path(archive.file, ninja_dir) << ": archive"
+            << ninja_paths(vector<path>(archive.members.begin(), archive.members.end()), ninja_dir) << "\n"
+            << "  cmd = " << ninja_escape(shell_command(archive.cmd)) << "\n";
+    }
+
+    vector<path> link_inputs;
+    for (auto const& input: link.inputs) {
+        if (!input.starts_with("-"))
+            link_inputs.push_back(input);
+    }
+    out << "build " << ninja_path(graph.output, ninja_dir) << ": link" << ninja_paths(link_inputs, ninja_dir) << "\n"
+        << "  cmd = " << ninja_escape(shell_command(link.cmd)) << "\n\n";
+
+    // a source added or removed changes the time of its directory
+    vector<path> sources = {root / "spear.toml"};
+    if (!workspace_root.empty())
+        sources.push_back(workspace_root / "spear.toml");
+    sources.push_back(graph.src_dir);
+    for (auto const& entry: fs::recursive_directory_iterator{graph.src_dir}) {
+        if (entry.is_directory())
+            sources.push_back(entry.path());
+    }
+    out << "build build.ninja: spear" << ninja_paths(sources, ninja_dir) << "\n\n"
+        << "default " << ninja_path(graph.output, ninja_dir) << "\n";
+
+    write_generated(ninja_file, out.str());
+}
+
+static void gen_compdb(Profile const& profile) {
+    Graph graph = build_graph(profile);
+
+    std::stringstream out;
+    out << "[\n";
+    for (size_t i = 0; i < graph.units.size(); i++) {
+        CompileUnit const& unit = graph.units[i];
+
+        string arguments;
+        for (auto const& arg: unit.args)
+            arguments += (arguments.empty() ? "" : ", ") + json_escape(arg);
+
+        out << "  {\n"
+            << "    \"directory\": " << json_escape(graph.src_dir.string()) << ",\n"
+            << "    \"arguments\": [" << arguments << "],\n"
+            << "    \"file\": " << json_escape((graph.src_dir / unit.src_file).lexically_normal().string()) << ",\n"
+            << "    \"output\": " << json_escape(unit.object.string()) << "\n"
+            << "  }" << (i + 1 < graph.units.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+
+    write_generated(root / "compile_commands.json", out.str());
+}
+
+void gen(const int argc, char* argv[]) {
+    CHECK((argc < 2), man::gen)
+    string kind = argv[1];
+    CHECK((kind != "ninja" && kind != "compdb"), man::gen)
+
+    // the training run of pgo and the binary per level of a multi versioned profile are more
+    // than a build graph
+    string name = argc > 2 ? argv[2] : "debug";
+    auto profile = find_profile(name);
+    if (name == "pgo" || (profile && !profile->targets.empty())) {
+        std::cout << "Error: spear gen does not support the '" << name << "' profile" << std::endl;
+        exit(1);
+    }
+    if (!profile) {
+        std::cout << "Error: unknown profile '" << name << "'" << std::endl;
+        exit(1);
+    }
+
+    if (kind == "ninja")
+        gen_ninja(*profile);
+    else
+        gen_compdb(*profile);
+}
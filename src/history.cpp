@@ -0,0 +1,68 @@
+#include "spear.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "runner.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using path = fs::path;
+
+// one line per output: "<output> <peak rss in KiB> <wall time in ms>"
+static path history_file(path const& output_dir) {
+    return output_dir / ".history";
+}
+
+History load_history(path const& output_dir) {
+    History history;
+    std::ifstream in(history_file(output_dir));
+    string line;
+    while (getline(in, line)) {
+        std::stringstream fields(line);
+        string output;
+        JobStats stats;
+        if (fields >> output >> stats.rss) {
+            fields >> stats.ms;
+            history[output] = stats;
+        }
+    }
+    return history;
+}
+
+void save_history(path const& output_dir, History const& history) {
+    std::ofstream out(history_file(output_dir));
+    for (auto const& [output, stats]: history)
+        out << output << " " << stats.rss << " " << stats.ms << "\n";
+}
+
+JobStats expected_stats(History const& history, string const& output) {
+    if (auto itr = history.find(output); itr != history.end())
+        return itr->second;
+
+    // never built, as heavy as an average unit of the tree
+    if (history.empty())
+        return {512 * 1024, 1000};
+
+    JobStats total;
+    for (auto const& [other, stats]: history) {
+        total.rss += stats.rss;
+        total.ms += stats.ms;
+    }
+    return {total.rss / history.size(), total.ms / history.size()};
+}
+
+size_t memory_share = 0;
+
+size_t memory_budget() {
+    if (memory_share > 0)
+        return memory_share;
+
+    // [compiler] memory in MiB overrides the memory found on the machine
+    double memory = settings.compiler.memory;
+    if (memory > 0)
+        return memory * 1024;
+    return runner::available_memory();
+}
@@ -0,0 +1,170 @@
+#include "spear.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+path find_program(string const& program) {
+    const char* env_path = getenv("PATH");
+    if (env_path == NULL)
+        return {};
+
+    std::stringstream dirs(env_path);
+    string dir;
+    while (std::getline(dirs, dir, ':')) {
+        if (!dir.empty() && access((path(dir) / program).c_str(), X_OK) == 0)
+            return path(dir) / program;
+    }
+    return {};
+}
+
+string select_linker() {
+    string linker = settings.compiler.linker;
+    if (linker != "auto")
+        return linker;
+
+    // fastest first, the compiler default (bfd) is the fallback
+    for (string candidate: {"mold", "lld", "gold"}) {
+        if (!find_program("ld." + candidate).empty())
+            return candidate;
+    }
+    return "";
+}
+
+static string join(strvec const& cmd) {
+    string joined;
+    for (auto const& arg: cmd)
+        joined += arg + " ";
+    return joined;
+}
+
+// the command that produced a file is stored next to it in .<file>.cmd
+static path stamp_file(path const& file) {
+    return file.parent_path() / ("." + file.filename().string() + ".cmd");
+}
+
+bool up_to_date(path const& output, strvec const& inputs, strvec const& cmd) {
+    if (!fs::exists(output) || !fs::exists(stamp_file(output)))
+        return false;
+
+    std::ifstream stamp(stamp_file(output));
+    string previous_cmd(std::istreambuf_iterator<char>(stamp), {});
+    if (previous_cmd != join(cmd))
+        return false;
+
+    auto const output_time = fs::last_write_time(output);
+    for (auto const& input: inputs) {
+        if (!fs::exists(input) || fs::last_write_time(input) > output_time)
+            return false;
+    }
+    return true;
+}
+
+void write_stamp(path const& output, strvec const& cmd) {
+    std::ofstream(stamp_file(output)) << join(cmd);
+}
+
+// objects living in a sub directory of object_dir are grouped in one thin archive per
+// directory, so the linker reads a single index instead of every object of the group
+static vector<Archive> archive_groups(path const& object_dir, strvec const& objects, strvec& inputs) {
+    std::map<string, strvec> groups;
+
+    for (auto const& object: objects) {
+        path relative = path(object).lexically_normal().lexically_relative(object_dir.lexically_normal());
+
+        if (relative.empty() || *relative.begin() == ".." || std::distance(relative.begin(), relative.end()) < 2) {
+            inputs.push_back(object);
+            continue;
+        }
+        groups[relative.begin()->string()].push_back(object);
+    }
+
+    vector<Archive> archives;
+    for (auto const& [group, members]: groups) {
+        path archive = object_dir / (group + ".a");
+        strvec ar_cmd = {"ar", "rcsT", archive};
+        ar_cmd.insert(ar_cmd.end(), members.begin(), members.end());
+        archives.push_back({archive, members, ar_cmd});
+
+        // keep every member, as if the objects were given one by one
+        inputs.push_back("-Wl,--whole-archive");
+        inputs.push_back(archive);
+        inputs.push_back("-Wl,--no-whole-archive");
+    }
+
+    return archives;
+}
+
+static strvec link_cmd(strvec const& inputs, path const& output, strvec const& link_options) {
+    strvec args = {cc};
+    args.insert(args.end(), link_options.begin(), link_options.end());
+
+    string linker = select_linker();
+    if (!linker.empty())
+        args.push_back("-fuse-ld=" + linker);
+
+    args.insert(args.end(), inputs.begin(), inputs.end());
+
+    auto dependencies = get_dependency_commands();
+    args.insert(args.end(), dependencies.begin(), dependencies.end());
+
+    args.push_back("-o");
+    args.push_back(output);
+    return args;
+}
+
+LinkCommands link_commands(path const& object_dir, strvec const& objects, path const& output, strvec const& link_options) {
+    LinkCommands link;
+    link.archives = archive_groups(object_dir, objects, link.inputs);
+    link.cmd = link_cmd(link.inputs, output, link_options);
+    return link;
+}
+
+bool link_objects(path const& object_dir, strvec const& objects, path const& output, strvec const& link_options) {
+    auto link = link_commands(object_dir, objects, output, link_options);
+
+    for (auto const& archive: link.archives) {
+        if (up_to_date(archive.file, archive.members, archive.cmd))
+            continue;
+
+        fs::remove(archive.file);
+        if (execute(archive.cmd)) {
+            write_stamp(archive.file, archive.cmd);
+            continue;
+        }
+
+        // without its archive, the objects of the group are linked one by one
+        auto itr = std::find(link.inputs.begin(), link.inputs.end(), archive.file.string());
+        itr = link.inputs.erase(itr - 1, itr + 2);
+        link.inputs.insert(itr, archive.members.begin(), archive.members.end());
+        link.cmd = link_cmd(link.inputs, output, link_options);
+    }
+
+    strvec files;
+    std::copy_if(link.inputs.begin(), link.inputs.end(), std::back_inserter(files), [](string const& input) {
+        return !input.starts_with("-");
+    });
+
+    if (up_to_date(output, files, link.cmd)) {
+        std::cout << output.filename().string() << " is up to date" << std::endl;
+        return true;
+    }
+
+    if (!execute(link.cmd))
+        return false;
+
+    write_stamp(output, link.cmd);
+    return true;
+}
@@ -11,13 +11,24 @@ if (value) {\
 namespace man {
 static std::string spear =
 "spear | new   <name>          | create a new project\n"
-"      | build [debug/release] | build the current project\n"
-"      | run   [debug/release] | run the current project\n"
+"      | build [profile]       | build the current project (debug, release, pgo or a [profile.<name>])\n"
+"      | run   [profile]       | run the current project\n"
+"      | test  [name]          | build and run the tests in test/ (--profile <profile>, debug by default)\n"
+"      | bench [name]          | build and run the benchmarks in bench/ (release profile)\n"
 "      | add   <name>          | add a library to use in the project\n"
 "      | clean                 | clean the project targets\n"
+"      |                       | at the root of a [workspace], build and clean run for every member\n"
 "      | package               | package the project into a library\n"
-"      | install               | install the release build in the path (default $XDG_DATA_HOME/spear/bin/)\n"
-"      | fetch <name> [url]    | download a library to use in any future project. (default libs location: $XDG_DATA_HOME/spear/libs/)\n";
+"      | install [profile]     | install the release build stripped in the path (default $XDG_DATA_HOME/spear/bin/),\n"
+"      |                       | the debug info goes to .debug/<name>.debug and <name>.dwp\n"
+"      | gen ninja [profile]   | write target/<profile>/build.ninja with the commands of spear build\n"
+"      | gen compdb [profile]  | write compile_commands.json with the compile commands of spear build\n"
+"      | analyze includes [p]  | rank the headers by what they cost the compiles of profile p (default debug)\n"
+"      | fetch <name> [url]    | download a library to use in any future project. (default libs location: $XDG_DATA_HOME/spear/libs/)\n"
+"      | cache serve <dir>     | serve a shared build cache over http (--listen [address:]port, default localhost:8090)\n"
+"      | server                | keep the project loaded and answer requests on a unix socket\n"
+"      | worker --listen [n]   | compile the units sent by [distributed] builds (on [address:]port n, default localhost:8091)\n"
+"every command accepts -j <n> to run at most n compilers at once (default [compiler] jobs or the cpu count)\n";
 
 static std::string new_ =
 "spear new <name>"
@@ -30,7 +41,32 @@ static std::string add =
 "          --local         -- if added, tell spear the library is already provided by the system\n";
 
 static std::string build =
-"spear bulid [debug/release]\n";
+"spear build [profile]\n"
+"            debug                   -- default, -Og -g3, split dwarf and compressed debug sections ([debug])\n"
+"            release                 -- -O3\n"
+"            pgo                     -- instrumented build, training run ([pgo] train/command),\n"
+"                                       then a -fprofile-use + LTO build in target/pgo/\n"
+"            asan/ubsan/tsan         -- debug with the address, undefined behavior or thread sanitizer\n"
+"            coverage                -- debug with --coverage, the .gcda files stay in target/coverage/\n"
+"            <name>                  -- a [profile.<name>] of spear.toml, inheriting from another profile\n"
+"a profile with targets = ['x86-64-v2', 'x86-64-v3', ...] builds one binary per cpu level and a\n"
+"dispatcher that runs the best one supported by the host\n";
+
+static std::string bench =
+"spear bench [name] [--save <baseline>] [--baseline <baseline>]\n"
+"            [name]                  -- only run the benchmarks whose name contain it\n"
+"            --save <baseline>       -- save the results as target/bench/<baseline>.toml\n"
+"            --baseline <baseline>   -- compare against a saved baseline, exit with 1 on regression\n"
+"each bench/<name>.cpp is linked with the project objects (except main) and run [bench] runs times\n"
+"after [bench] warmup runs. A regression is a median change over [bench] threshold percent\n"
+"whose confidence interval does not overlap with the baseline one.";
+
+static std::string test =
+"spear test [name] [--profile <profile>]\n"
+"           [name]                   -- only run the tests whose name contain it\n"
+"           --profile <profile>      -- build the tests with this profile (default debug)\n"
+"each test/<name>.cpp is linked with the project objects (except main), a test passes when it exits with 0.\n"
+"asan, ubsan, tsan and coverage are instrumented debug profiles with their own target/<profile>/ tree.";
 
 static std::string enable_feature =
 "spear enable <lib_name> <features>\n"
@@ -39,4 +75,49 @@ static std::string enable_feature =
 "example:\n"
 "spear enable sdl2 image ttf        -- enable the image and ttf features of the sdl2 library";
 
+
+static std::string cache =
+"spear cache serve <dir> [--listen [address:]port]\n"
+"                  <dir>             -- where the artifacts are stored, a [cache] url directory works too\n"
+"                  --listen          -- default localhost:8090, 0.0.0.0 or [::] for every interface\n"
+"a reference server for [cache] url = 'http://<host>:<port>': GET and PUT /<key>, one request at a time.\n"
+"anyone reaching it can store objects: keep it on a trusted network";
+
+static std::string gen =
+"spear gen ninja|compdb [profile]\n"
+"          ninja             -- target/<profile>/build.ninja, build it with ninja -C target/<profile>\n"
+"          compdb            -- compile_commands.json at the project root\n"
+"          [profile]         -- default debug, pgo and multi versioned profiles are not supported\n"
+"                               a workspace root is not supported, gen runs in each member\n"
+"the commands are the ones of spear build, a file is only rewritten when it changed and ninja runs\n"
+"spear gen ninja again when spear.toml or the source files change";
+
+static std::string analyze =
+"spear analyze includes [profile] [--top <n>]\n"
+"              [profile]         -- default debug\n"
+"              --top <n>         -- headers shown (default 20)\n"
+"every header a source includes, directly or not, with the sources pulling it in, its size in their\n"
+"preprocessed output and with clang its parse time from -ftime-trace, both with the headers it includes";
+
+static std::string worker =
+"spear worker --listen [[address:]port]\n"
+"             [port]                 -- default 8091\n"
+"             [address]              -- default localhost, 0.0.0.0 or [::] for every interface\n"
+"             -j <n>                 -- compiles at once (default the cpu count)\n"
+"compiles the preprocessed units sent by spear builds with [distributed] workers = ['<host>:<port>', ...],\n"
+"only the code generation flags are run (-O, -g, -f, -m, -W, -std=) but there is no authentication:\n"
+"keep it on a trusted network";
+
+static std::string server =
+"spear server [--socket <path>]\n"
+"             --socket <path>        -- default target/spear.sock\n"
+"one request per connection, a line with its words, answered by its output and a line 'exit <code>':\n"
+"  build [profile]                   -- build the project, or every member of a workspace\n"
+"  run [profile] [args...]           -- build and run the project\n"
+"  query name|root                   -- project name or root directory\n"
+"  query target|flags [profile]      -- path of the binary, compile flags of the profile\n"
+"  query config <key>                -- a value of spear.toml (ex: project.version)\n"
+"  reload | stop                     -- read the configs again, stop the server\n"
+"example: echo 'query flags release' | socat - UNIX-CONNECT:target/spear.sock";
+
 }
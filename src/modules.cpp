@@ -0,0 +1,120 @@
+#include "spear.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+ModuleInfo scan_modules(path const& src_file) {
+    static const std::regex declaration("^(export +)?module +([A-Za-z_][A-Za-z0-9_.]*)(:[A-Za-z_][A-Za-z0-9_.]*)? *;.*");
+    static const std::regex import("^(export +)?import +([A-Za-z_][A-Za-z0-9_.]*)?(:[A-Za-z_][A-Za-z0-9_.]*)? *;.*");
+
+    ModuleInfo info;
+    string primary;
+
+    std::ifstream infile(src_file);
+    string line;
+    bool in_comment = false;
+    while (getline(infile, line)) {
+        // declarations are never inside comments, and only block comments span lines
+        if (in_comment) {
+            size_t end = line.find("*/");
+            if (end == string::npos)
+                continue;
+            line.erase(0, end + 2);
+            in_comment = false;
+        }
+        if (size_t start = line.find("/*"); start != string::npos && line.find("*/", start) == string::npos) {
+            line.erase(start);
+            in_comment = true;
+        }
+
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.starts_with("export") && !line.starts_with("module") && !line.starts_with("import"))
+            continue;
+
+        std::smatch match;
+        if (std::regex_match(line, match, declaration)) {
+            primary = match[2];
+            string partition = match[3];
+
+            // interfaces and partitions produce a module interface, the other units implement one
+            if (match[1].matched || !partition.empty())
+                info.provides = primary + partition;
+            else
+                info.imports.push_back(primary);
+        }
+        else if (std::regex_match(line, match, import)) {
+            // import :part; refers to a partition of the current module
+            string name = match[2].matched ? match[2].str() : primary;
+            info.imports.push_back(name + match[3].str());
+        }
+    }
+
+    return info;
+}
+
+path module_interface(path const& bmi_dir, string const& module) {
+    string file = module;
+    std::replace(file.begin(), file.end(), ':', '-');
+    return bmi_dir / (file + (is_clang() ? ".pcm" : ".gcm"));
+}
+
+// gcc finds the module interfaces through a mapper file listing "<module> <bmi>", it is
+// shared by every compile of the profile so tests and benchmarks can import project modules
+static path update_mapper(path const& bmi_dir, strvec const& modules) {
+    path mapper = bmi_dir / "mapper";
+    std::map<string, string> entries;
+
+    std::ifstream previous(mapper);
+    string name, file;
+    while (previous >> name >> file)
+        entries[name] = file;
+    previous.close();
+
+    bool changed = false;
+    for (auto const& module: modules) {
+        string file = module_interface(bmi_dir, module);
+        if (entries[module] != file) {
+            entries[module] = file;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        std::ofstream out(mapper);
+        for (auto const& [module, file]: entries)
+            out << module << " " << file << "\n";
+    }
+    return mapper;
+}
+
+strvec module_args(path const& bmi_dir, strvec const& modules) {
+    fs::create_directories(bmi_dir);
+
+    if (is_clang())
+        return {"-fprebuilt-module-path=" + bmi_dir.string()};
+    return {"-fmodules-ts", "-fmodule-mapper=" + update_mapper(bmi_dir, modules).string()};
+}
+
+strvec module_interface_args(path const& bmi_dir, path const& src_file, ModuleInfo const& info) {
+    strvec args;
+    if (is_clang() && !info.provides.empty())
+        args.push_back("-fmodule-output=" + module_interface(bmi_dir, info.provides).string());
+
+    // .cppm/.ixx/.mpp are not known as c++ by the compiler driver
+    string extension = src_file.extension();
+    if (extension == ".cppm" || extension == ".ixx" || extension == ".mpp") {
+        args.push_back("-x");
+        args.push_back(is_clang() ? "c++-module" : "c++");
+    }
+    return args;
+}
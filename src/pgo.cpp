@@ -0,0 +1,134 @@
+#include "spear.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+static void add_options(Profile& profile, strvec const& options, bool link) {
+    profile.options.insert(profile.options.end(), options.begin(), options.end());
+    if (link)
+        profile.link_options.insert(profile.link_options.end(), options.begin(), options.end());
+}
+
+static bool train(path const& binary) {
+    strvec command = settings.pgo.command;
+    if (command.empty()) {
+        auto const& args = settings.pgo.train;
+        command.push_back(binary);
+        command.insert(command.end(), args.begin(), args.end());
+    }
+
+    // custom training scripts find the instrumented binary here
+    setenv("SPEAR_PGO_BINARY", binary.c_str(), 1);
+    fs::current_path(root);
+    return execute(command);
+}
+
+// gcc accumulates every run in the same .gcda files, clang needs its raw profiles merged
+static bool merge_profiles(path const& data_dir, path const& profdata, path const& generate_objects, path const& use_objects) {
+    strvec raw_profiles;
+    for (auto const& entry: fs::recursive_directory_iterator{data_dir}) {
+        if (entry.path().extension() == ".profraw" || entry.path().extension() == ".gcda")
+            raw_profiles.push_back(entry.path());
+    }
+
+    if (raw_profiles.empty()) {
+        std::cout << "Error: the training run produced no profile data in " << data_dir.string() << std::endl;
+        return false;
+    }
+
+    if (!is_clang()) {
+        // gcc looks for <data_dir>/<object path>.gcda, move the counters of the
+        // instrumented objects where the optimized objects will look for them
+        path generated = data_dir / generate_objects.relative_path();
+        path expected = data_dir / use_objects.relative_path();
+
+        // a unit the training run never reached is optimized without profile
+        for (auto const& entry: fs::recursive_directory_iterator{generate_objects}) {
+            if (entry.path().extension() != ".o")
+                continue;
+            path counters = generated / entry.path().lexically_relative(generate_objects);
+            counters.replace_extension(".gcda");
+            if (!fs::exists(counters))
+                std::cout << "Warning: no profile for " << entry.path().lexically_relative(generate_objects).string() << std::endl;
+        }
+
+        std::error_code error;
+        fs::remove_all(expected, error);
+        fs::create_directories(expected.parent_path(), error);
+        if (!error)
+            fs::rename(generated, expected, error);
+        if (error) {
+            std::cout << "Error: could not move the profile data of " << generated.string() << " to " << expected.string() << ": " << error.message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    strvec merge = {"llvm-profdata", "merge", "-output=" + profdata.string()};
+    merge.insert(merge.end(), raw_profiles.begin(), raw_profiles.end());
+    return execute(merge);
+}
+
+bool build_pgo() {
+    string base = settings.pgo.inherits;
+    auto parent = find_profile(base);
+    if (!parent) {
+        std::cout << "Error: unknown profile '" << base << "' in [pgo] inherits" << std::endl;
+        return false;
+    }
+
+    Profile generate = *parent;
+    generate.name = "pgo-generate";
+    Profile use = *parent;
+    use.name = "pgo";
+
+    path data_dir = target_root / "pgo" / "data";
+    path profdata = data_dir / "default.profdata";
+
+    path generate_objects = target_root / generate.name / "object";
+    path use_objects = target_root / use.name / "object";
+
+    add_options(generate, {"-fprofile-generate=" + data_dir.string()}, true);
+    if (!is_clang()) {
+        add_options(generate, {"-fprofile-update=atomic"}, false);
+        add_options(use, {"-fprofile-use=" + data_dir.string(), "-Wno-missing-profile"}, true);
+    }
+    else {
+        add_options(use, {"-fprofile-use=" + profdata.string(), "-Wno-profile-instr-unprofiled"}, true);
+    }
+
+    // link time optimization with parallel code generation
+    string lto = settings.pgo.lto.value_or(is_clang() ? "-flto=thin" : "-flto=auto");
+    if (lto != "none")
+        add_options(use, {lto}, true);
+
+    std::cout << "INSTRUMENTING" << std::endl;
+    if (!build_profile(generate))
+        return false;
+
+    // counters of a previous binary would not match the new one
+    fs::remove_all(data_dir);
+    fs::create_directories(data_dir);
+
+    std::cout << "TRAINING" << std::endl;
+    if (!train(target_root / generate.name / "build" / project_name)) {
+        std::cout << "Error: the training command failed" << std::endl;
+        return false;
+    }
+    if (!merge_profiles(data_dir, profdata, generate_objects, use_objects))
+        return false;
+
+    // the flags did not change but the profile did, every object has to be rebuilt
+    fs::remove_all(use_objects);
+
+    std::cout << "OPTIMIZING" << std::endl;
+    return build_profile(use);
+}
@@ -0,0 +1,364 @@
+#include "runner.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <poll.h>
+#include <sstream>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+using std::string;
+using strvec = std::vector<string>;
+
+namespace runner {
+
+std::optional<Process> spawn(strvec const& cmd, Output output, string const& dir) {
+    std::vector<char*> argv;
+    for (auto const& arg: cmd)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(NULL);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    // close on exec, so the other jobs do not keep this pipe open
+    int pipe_fds[2] = {-1, -1};
+    if (output == Output::capture) {
+        if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+            posix_spawn_file_actions_destroy(&actions);
+            return std::nullopt;
+        }
+        posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDERR_FILENO);
+    }
+    else if (output == Output::discard) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    if (!dir.empty())
+        posix_spawn_file_actions_addchdir_np(&actions, dir.c_str());
+
+    Process process;
+    int error = posix_spawnp(&process.pid, argv[0], &actions, NULL, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (pipe_fds[1] >= 0)
+        close(pipe_fds[1]);
+
+    if (error != 0) {
+        if (pipe_fds[0] >= 0)
+            close(pipe_fds[0]);
+        std::cerr << cmd[0] << ": " << strerror(error) << std::endl;
+        return std::nullopt;
+    }
+
+    process.output_fd = pipe_fds[0];
+    return process;
+}
+
+// returns false once the process closed its output
+static bool read_output(Process& process) {
+    char buffer[65536];
+    ssize_t size = read(process.output_fd, buffer, sizeof(buffer));
+    if (size < 0 && errno == EINTR)
+        return true;
+    if (size <= 0) {
+        close(process.output_fd);
+        process.output_fd = -1;
+        return false;
+    }
+
+    process.output.append(buffer, size);
+    return true;
+}
+
+static int reap(Process& process, struct rusage* usage) {
+    int status;
+    struct rusage ignored;
+    while (wait4(process.pid, &status, 0, usage ? usage : &ignored) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+int wait(Process& process, struct rusage* usage) {
+    while (process.output_fd >= 0)
+        read_output(process);
+    return reap(process, usage);
+}
+
+// first number of a file, nullopt when missing or not a number ("max")
+static std::optional<size_t> read_number(string const& file) {
+    std::ifstream in(file);
+    size_t value;
+    if (!(in >> value))
+        return std::nullopt;
+    return value;
+}
+
+struct MemoryCgroup {
+    fs::path dir;       // spear's cgroup, or the closest existing parent
+    fs::path mount;     // the top of the hierarchy visible here
+    bool v2;
+};
+
+// the cgroups of spear from /proc/self/cgroup, found under the mount points of
+// /proc/self/mountinfo. A mount of a namespace or a v1 hierarchy shows the cgroup path from
+// its own root (the 4th field).
+static std::vector<MemoryCgroup> memory_cgroups() {
+    std::map<bool, string> paths;     // v2 -> cgroup path
+    std::ifstream self("/proc/self/cgroup");
+    string line;
+    while (getline(self, line)) {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == string::npos || second == string::npos)
+            continue;
+        string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+        if (line.starts_with("0::"))
+            paths[true] = line.substr(second + 1);
+        else if (controllers.find(",memory,") != string::npos)
+            paths[false] = line.substr(second + 1);
+    }
+
+    std::vector<MemoryCgroup> cgroups;
+    std::ifstream mounts("/proc/self/mountinfo");
+    while (getline(mounts, line)) {
+        std::stringstream fields(line);
+        string id, parent, device, root, mount_point, field;
+        fields >> id >> parent >> device >> root >> mount_point;
+        while (fields >> field && field != "-") {}
+        string type, source, options;
+        fields >> type >> source >> options;
+
+        bool v2 = type == "cgroup2";
+        if (!v2 && (type != "cgroup" || ("," + options + ",").find(",memory,") == string::npos))
+            continue;
+        if (!paths.count(v2))
+            continue;
+
+        fs::path relative = fs::path(paths[v2]).lexically_relative(root);
+        fs::path dir = fs::path(mount_point);
+        if (!relative.empty() && *relative.begin() != "..")
+            dir = (dir / relative).lexically_normal();
+        while (dir != mount_point && !fs::exists(dir))
+            dir = dir.parent_path();
+        cgroups.push_back({dir, mount_point, v2});
+    }
+    return cgroups;
+}
+
+size_t available_memory() {
+    size_t available = SIZE_MAX;
+
+    std::ifstream meminfo("/proc/meminfo");
+    string key;
+    size_t value;
+    string unit;
+    while (meminfo >> key >> value >> unit) {
+        if (key == "MemAvailable:") {
+            available = value;
+            break;
+        }
+    }
+
+    // containers and systemd slices see the host memory in /proc/meminfo, their limits are in
+    // spear's cgroup and the ones above it (v2, and v1 memory controller)
+    for (auto const& cgroup: memory_cgroups()) {
+        fs::path dir = cgroup.dir;
+        while (true) {
+            auto limit = read_number(dir / (cgroup.v2 ? "memory.max" : "memory.limit_in_bytes"));
+            auto usage = read_number(dir / (cgroup.v2 ? "memory.current" : "memory.usage_in_bytes"));
+            if (limit && usage)
+                available = std::min(available, *limit > *usage ? (*limit - *usage) / 1024 : 0);
+            if (dir == cgroup.mount || !dir.has_relative_path())
+                break;
+            dir = dir.parent_path();
+        }
+    }
+
+    return available == SIZE_MAX ? 0 : available;
+}
+
+JobPool::JobPool(size_t max_jobs, size_t memory_budget)
+    : max_jobs(std::max<size_t>(1, max_jobs)), memory_budget(memory_budget) {}
+
+size_t JobPool::add(Job job) {
+    jobs.push_back(std::move(job));
+    return jobs.size() - 1;
+}
+
+static string command_line(strvec const& cmd) {
+    string line;
+    for (auto const& arg: cmd)
+        line += arg + " ";
+    return line;
+}
+
+bool JobPool::run() {
+    struct Running {
+        size_t job;
+        Process process;
+        std::chrono::steady_clock::time_point start;
+    };
+    std::vector<Running> running;
+    bool failed = false;
+
+    // a job is ready once all its dependencies succeeded
+    std::vector<size_t> missing_deps(jobs.size());
+    std::vector<std::vector<size_t>> dependents(jobs.size());
+    std::deque<size_t> ready;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        missing_deps[i] = jobs[i].deps.size();
+        for (size_t dep: jobs[i].deps)
+            dependents[dep].push_back(i);
+        if (missing_deps[i] == 0)
+            ready.push_back(i);
+    }
+    size_t finished = 0;
+
+    // critical path: a job duration plus the longest path of its dependents, the dependents
+    // are done first by walking a topological order backward
+    std::vector<size_t> order(ready.begin(), ready.end());
+    std::vector<size_t> deps_left = missing_deps;
+    for (size_t i = 0; i < order.size(); i++) {
+        for (size_t dependent: dependents[order[i]]) {
+            if (--deps_left[dependent] == 0)
+                order.push_back(dependent);
+        }
+    }
+    std::vector<size_t> critical_path(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++)
+        critical_path[i] = jobs[i].duration;
+    for (auto itr = order.rbegin(); itr != order.rend(); itr++) {
+        for (size_t dependent: dependents[*itr])
+            critical_path[*itr] = std::max(critical_path[*itr], jobs[*itr].duration + critical_path[dependent]);
+    }
+
+    auto cancel = [&running]() {
+        for (auto& job: running)
+            kill(job.process.pid, SIGTERM);
+    };
+
+    size_t used_memory = 0;
+    size_t running_remote = 0;
+
+    // the ready job with the longest critical path fitting in the memory left and with a free
+    // slot of its kind, a job too big for the budget runs alone
+    auto next_job = [&]() -> std::optional<size_t> {
+        auto best = ready.end();
+        for (auto itr = ready.begin(); itr != ready.end(); itr++) {
+            bool slot = jobs[*itr].remote ? running_remote < remote_jobs : running.size() - running_remote < max_jobs;
+            bool fits = slot && (memory_budget == 0 || running.empty() || used_memory + jobs[*itr].memory <= memory_budget);
+            if (fits && (best == ready.end() || critical_path[*itr] > critical_path[*best]))
+                best = itr;
+        }
+        if (best == ready.end())
+            return std::nullopt;
+
+        size_t job = *best;
+        ready.erase(best);
+        return job;
+    };
+
+    while (!running.empty() || (!ready.empty() && !failed)) {
+        while (!failed) {
+            auto job = next_job();
+            if (!job)
+                break;
+
+            auto process = spawn(jobs[*job].cmd, Output::capture, jobs[*job].dir);
+            if (!process) {
+                failed = true;
+                cancel();
+                break;
+            }
+            used_memory += jobs[*job].memory;
+            running_remote += jobs[*job].remote;
+            running.push_back({*job, std::move(*process), std::chrono::steady_clock::now()});
+        }
+
+        if (running.empty())
+            break;
+
+        std::vector<pollfd> fds;
+        for (auto const& job: running)
+            fds.push_back({job.process.output_fd, POLLIN, 0});
+
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+            return false;
+
+        // walk backward so finished jobs can be erased in place
+        for (size_t i = fds.size(); i-- > 0;) {
+            if (!fds[i].revents || read_output(running[i].process))
+                continue;
+
+            Running done = std::move(running[i]);
+            running.erase(running.begin() + i);
+            Job& job = jobs[done.job];
+            used_memory -= job.memory;
+            running_remote -= job.remote;
+
+            struct rusage usage;
+            int status = reap(done.process, &usage);
+
+            // no worker could compile it, it waits for a local slot
+            if (job.remote && status == retry_locally && !failed) {
+                std::cout << done.process.output << std::flush;
+                job.remote = false;
+                job.cmd = job.local_cmd;
+                ready.push_back(done.job);
+                continue;
+            }
+
+            // a cancelled job's diagnostics are noise next to the real failure
+            if (failed && status != 0)
+                continue;
+
+            std::cout << command_line(job.cmd) << "\n" << done.process.output << std::flush;
+
+            if (status != 0) {
+                std::cout << "Error: " << job.cmd[0] << " exited with " << status << std::endl;
+                failed = true;
+                cancel();
+                continue;
+            }
+
+            finished++;
+            if (job.on_success)
+                job.on_success(usage, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - done.start).count());
+
+            for (size_t dependent: dependents[done.job]) {
+                if (--missing_deps[dependent] == 0)
+                    ready.push_back(dependent);
+            }
+        }
+    }
+
+    if (!failed && finished != jobs.size()) {
+        std::cout << "Error: dependency cycle between " << jobs.size() - finished << " jobs" << std::endl;
+        failed = true;
+    }
+
+    jobs.clear();
+    return !failed;
+}
+
+}
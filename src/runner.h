@@ -0,0 +1,65 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace runner {
+
+enum class Output {
+    inherit,    // the process writes to spear's stdout/stderr
+    capture,    // stdout and stderr go to Process::output
+    discard,    // stdout goes to /dev/null
+};
+
+struct Process {
+    pid_t pid = -1;
+    int output_fd = -1;
+    std::string output;
+};
+
+// starts cmd with posix_spawnp, which vforks instead of copying the whole spear process,
+// in dir when it is not empty
+std::optional<Process> spawn(std::vector<std::string> const& cmd, Output output = Output::inherit, std::string const& dir = "");
+
+// reads the captured output until the process closes it, then reaps it
+// returns the exit code, 128 + signal when it was killed
+int wait(Process& process, struct rusage* usage = nullptr);
+
+// memory the jobs can use in KiB: MemAvailable, capped by the limits of spear's cgroup and its parents
+size_t available_memory();
+
+struct Job {
+    std::vector<std::string> cmd;
+    std::function<void(struct rusage const&, size_t wall_ms)> on_success;     // wall_ms: from spawn to exit
+    std::vector<size_t> deps;   // jobs of the same pool that have to succeed first
+    size_t memory = 0;          // expected peak rss in KiB
+    size_t duration = 0;        // expected ms
+    std::string dir;            // working directory, spear's one when empty
+    bool remote = false;        // compiles on a [distributed] worker, takes a remote slot
+    std::vector<std::string> local_cmd;     // what a remote job exiting with retry_locally runs instead
+};
+
+// exit code of a remote job asking to run as a local one
+constexpr int retry_locally = 75;
+
+// runs jobs with at most max_jobs local processes and remote_jobs remote ones at once, each
+// job output is printed in one block once it is done. The first failure cancels the jobs still running.
+// The ready job with the longest chain of durations left (its own and its dependents')
+// starts first. A job only starts when its expected memory fits next to the running
+// ones, lighter ready jobs take its place in the meantime.
+struct JobPool {
+    size_t max_jobs;
+    size_t memory_budget;       // KiB, 0 for no limit
+    size_t remote_jobs = 0;     // slots of the [distributed] workers
+    std::vector<Job> jobs;
+
+    JobPool(size_t max_jobs, size_t memory_budget = 0);
+    size_t add(Job job);
+    bool run();
+};
+
+}
@@ -0,0 +1,278 @@
+#include "session.h"
+
+#include <algorithm>
+#include <csignal>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "man.h"
+#include "runner.h"
+#include "spear.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+BuildSession::BuildSession(path const& dir): dir(dir) {
+    reload();
+}
+
+fs::file_time_type BuildSession::config_time() const {
+    std::error_code error;
+    auto time = fs::last_write_time(root / "spear.toml", error);
+    if (!workspace_root.empty() && workspace_root != root)
+        time = std::max(time, fs::last_write_time(workspace_root / "spear.toml", error));
+    return time;
+}
+
+void BuildSession::reload() {
+    ::root = dir;
+    find_root();
+    find_global_config();
+    find_lib_configs();
+    find_project_config();
+
+    ::workspace_root.clear();
+    ::workspace_config = {};
+    if (is_workspace(::project_config)) {
+        ::workspace_root = ::root;
+        ::workspace_config = ::project_config;
+        ::target_root = ::root / "target";
+        ::project_name = "";
+        bind_settings();
+    }
+    else {
+        find_workspace();
+        load_project(::root);
+    }
+    // a session keeps serving with a bad [compiler] jobs, its requests use the cpu count
+    ::jobs = configured_jobs().value_or(std::max(1u, std::thread::hardware_concurrency()));
+
+    root = ::root;
+    target_root = ::target_root;
+    workspace_root = ::workspace_root;
+    project_config = ::project_config;
+    workspace_config = ::workspace_config;
+    settings = ::settings;
+    project_name = ::project_name;
+    cc = ::cc;
+    jobs = ::jobs;
+    loaded = config_time();
+}
+
+void BuildSession::activate() {
+    if (config_time() != loaded) {
+        reload();
+        return;
+    }
+
+    ::root = root;
+    ::target_root = target_root;
+    ::workspace_root = workspace_root;
+    ::project_config = project_config;
+    ::workspace_config = workspace_config;
+    ::settings = settings;
+    ::project_name = project_name;
+    ::cc = cc;
+    ::jobs = jobs;
+}
+
+bool BuildSession::build(string const& profile) {
+    activate();
+    if (workspace_root == root)
+        return build_workspace(profile);
+    return build_named(profile);
+}
+
+int BuildSession::run(string const& profile, strvec const& args) {
+    if (workspace_root == root) {
+        std::cout << "Error: " << root.string() << " is a workspace, run a session in one of its members" << std::endl;
+        return 1;
+    }
+    if (!build(profile))
+        return 1;
+
+    strvec cmd = {target_root / profile / "build" / project_name};
+    cmd.insert(cmd.end(), args.begin(), args.end());
+
+    std::cout << "RUNING" << std::endl;
+    auto process = runner::spawn(cmd, runner::Output::inherit, root);
+    return process ? runner::wait(*process) : 127;
+}
+
+std::optional<string> BuildSession::query(strvec const& request) {
+    activate();
+    if (request.empty())
+        return std::nullopt;
+
+    string what = request[0];
+    string profile = request.size() > 1 ? request[1] : "debug";
+
+    if (what == "name")
+        return project_name;
+    if (what == "root")
+        return root.string();
+    if (what == "target")
+        return (target_root / profile / "build" / project_name).string();
+
+    // the compile command of the sources, without the output and input files
+    if (what == "flags") {
+        auto found = find_profile(profile);
+        if (!found)
+            return std::nullopt;
+
+        string flags;
+        strvec args = profile_args(*found);
+        args.pop_back();
+        for (auto const& arg: args)
+            flags += (flags.empty() ? "" : " ") + arg;
+        return flags;
+    }
+
+    if (what == "config" && request.size() > 1) {
+        auto const& config = config_document(request[1]);
+        if (auto value = config.get<string>(request[1]))
+            return value;
+        return config.text(request[1]);
+    }
+    return std::nullopt;
+}
+
+// the words of the request line, up to the newline
+static std::optional<strvec> read_request(int client) {
+    string line;
+    char c;
+    while (recv(client, &c, 1, 0) == 1 && c != '\n')
+        line += c;
+    if (line.empty())
+        return std::nullopt;
+
+    strvec words;
+    std::stringstream stream(line);
+    string word;
+    while (stream >> word)
+        words.push_back(word);
+    return words;
+}
+
+static int handle(BuildSession& session, strvec const& request, bool& stop) {
+    string command = request[0];
+    strvec args(request.begin() + 1, request.end());
+
+    if (command == "build")
+        return session.build(args.empty() ? "debug" : args[0]) ? 0 : 1;
+
+    if (command == "run") {
+        string profile = args.empty() ? "debug" : args[0];
+        strvec program_args(args.begin() + std::min<size_t>(args.size(), 1), args.end());
+        return session.run(profile, program_args);
+    }
+
+    if (command == "query") {
+        auto answer = session.query(args);
+        if (!answer) {
+            std::cout << "Error: unknown query" << std::endl;
+            return 1;
+        }
+        std::cout << *answer << std::endl;
+        return 0;
+    }
+
+    if (command == "reload") {
+        session.reload();
+        return 0;
+    }
+
+    if (command == "stop") {
+        stop = true;
+        return 0;
+    }
+
+    std::cout << "Error: unknown request '" << command << "'" << std::endl;
+    return 1;
+}
+
+void serve_session(BuildSession& session, path const& socket_path) {
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.string().size() >= sizeof(address.sun_path)) {
+        std::cout << "Error: socket path " << socket_path.string() << " is too long" << std::endl;
+        return;
+    }
+    socket_path.string().copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+    fs::create_directories(socket_path.parent_path());
+    fs::remove(socket_path);
+    // only the user running the server can connect, the requests build and run programs
+    mode_t mask = umask(0177);
+    bool bound = server >= 0 && bind(server, (sockaddr*)&address, sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(server, 16) < 0) {
+        perror("spear server");
+        return;
+    }
+    std::cout << "listening on " << socket_path.string() << std::endl;
+
+    // the output of a request, and of the programs it starts, goes to its client
+    signal(SIGPIPE, SIG_IGN);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int saved_stderr = dup(STDERR_FILENO);
+    bool stop = false;
+    while (!stop) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0)
+            continue;
+
+        auto request = read_request(client);
+        if (request) {
+            std::cout << std::flush;
+            dup2(client, STDOUT_FILENO);
+            dup2(client, STDERR_FILENO);
+
+            // a failing request (filesystem, config) answers its client, the server goes on
+            int code = 1;
+            try {
+                code = handle(session, *request, stop);
+            }
+            catch (std::exception const& error) {
+                std::cout << "Error: " << error.what() << std::endl;
+            }
+            std::cout << "exit " << code << std::endl;
+
+            dup2(saved_stdout, STDOUT_FILENO);
+            dup2(saved_stderr, STDERR_FILENO);
+            // a client leaving mid-request fails the writes (EPIPE), the next ones must go out
+            std::cout.clear();
+            std::cerr.clear();
+        }
+        close(client);
+    }
+
+    close(server);
+    fs::remove(socket_path);
+}
+
+void server(const int argc, char* argv[]) {
+    BuildSession session(root);
+
+    path socket_path = target_root / "spear.sock";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc)
+            socket_path = fs::absolute(argv[++i]);
+        else {
+            std::cout << man::server << std::endl;
+            return;
+        }
+    }
+    serve_session(session, socket_path);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "spear.h"
+
+// a project (or workspace) loaded once, for tools running many builds and queries in
+// the same process. The spear functions work on the project globals, a session puts its
+// state back in them before each call and reloads it when a spear.toml changed.
+struct BuildSession {
+    std::filesystem::path dir;
+
+    explicit BuildSession(std::filesystem::path const& dir);
+
+    bool build(std::string const& profile = "debug");
+    // builds then runs the binary, returns its exit code
+    int run(std::string const& profile, std::vector<std::string> const& args);
+    // name | root | target [profile] | flags [profile] | config <key>, nullopt when unknown
+    std::optional<std::string> query(std::vector<std::string> const& request);
+    void reload();
+
+private:
+    std::filesystem::path root;
+    std::filesystem::path target_root;
+    std::filesystem::path workspace_root;
+    toml::Document project_config;
+    toml::Document workspace_config;
+    Settings settings;
+    std::string project_name;
+    std::string cc;
+    size_t jobs;
+    std::filesystem::file_time_type loaded;
+
+    std::filesystem::file_time_type config_time() const;
+    void activate();
+};
+
+// answers one request per connection on a unix socket: a line with the words of the
+// request (build [profile], run [profile] [args...], query ..., reload, stop). The output
+// follows, then a last line "exit <code>"
+void serve_session(BuildSession& session, std::filesystem::path const& socket_path);
@@ -1,23 +1,30 @@
 #include "spear.h"
 
 #include <algorithm>
+#include <charconv>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
 #include <optional>
 #include <sched.h>
 #include <string>
 #include <filesystem>
 #include <string_view>
+#include <thread>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <vector>
 
 #include "toml/toml.h"
+#include "cache.h"
 #include "man.h"
+#include "runner.h"
+#include "worker.h"
 
 namespace fs = std::filesystem;
 using std::string;
@@ -33,32 +40,62 @@ string hello_world_prgm =
 "    return 0;\n"
 "};\n";
 string cc = "g++";
+size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+size_t cli_jobs = 0;
 
 path root = fs::current_path();
-
-toml::Table lib_configs;
-toml::Table project_config;
-toml::Table global_config;
+path target_root;
+path workspace_root;
+toml::Document workspace_config;
+path spear_exe;
+
+path lib_configs_path;
+toml::Document project_config;
+toml::Document global_config;
+path global_config_path;
+Settings settings;
 string project_name;
 
-void find_project_name() {
-    project_name = project_config["project.name"].value()->as<toml::String>()->_data;
+bool is_clang() {
+    return cc.find("clang") != string::npos;
+}
+
+path spear_executable() {
+    return spear_exe.empty() ? find_program("spear") : spear_exe;
+}
+
+// a table of a document into value, a mistyped key keeps the value it had
+template<class T>
+static void bind_table(T& value, toml::Document const& document, path const& file, string const& table) {
+    auto binding = toml::bind(document, table, value);
+    for (auto const& error: binding.errors)
+        std::cout << "Error: " << file.string() << " " << error << std::endl;
+    value = std::move(binding.value);
+}
+
+// [project], from the index of spear.toml
+static void find_project() {
+    ProjectConfig project;
+    bind_table(project, project_config, root / "spear.toml", "project");
+
+    project_name = project.name;
     if (project_name == "") project_name = "a.out";
+    cc = project.cc;
 }
 
 void find_project_config() {
-    project_config = toml::parse(root / "spear.toml");
+    project_config = toml::index(root / "spear.toml");
 }
 
 void find_global_config() {
     path xdg_config_home(getenv("XDG_CONFIG_HOME"));
     path home(getenv("HOME"));
 
-    path global_config_path = fs::exists(xdg_config_home)
+    global_config_path = fs::exists(xdg_config_home)
         ? xdg_config_home / "spear.toml"
         : home / ".config"/"spear.toml";
 
-    global_config = toml::parse(global_config_path);
+    global_config = toml::index(global_config_path);
 }
 
 void find_lib_configs() {
@@ -70,7 +107,17 @@ void find_lib_configs() {
         ? xdg_data_home / "spear"/"libs.toml"
         : home / ".local"/"share"/"spear"/"libs.toml";
 
-    lib_configs = toml::parse(libs_config_path);
+    lib_configs_path = libs_config_path;
+}
+
+// the [name] table of libs.toml, read only by the commands using it
+std::optional<LibEntry> find_lib(string const& name) {
+    auto lib = toml::bind<LibEntry>(toml::read(lib_configs_path), name);
+    for (auto const& error: lib.errors)
+        std::cout << "Error: " << lib_configs_path.string() << " " << error << std::endl;
+    if (!lib.found)
+        return std::nullopt;
+    return lib.value;
 }
 
 void find_root() {
@@ -78,51 +125,116 @@ void find_root() {
         root = root.parent_path();
 }
 
-void m_execvp(strvec cmd) {
-    char** c_cmd = (char**)malloc((cmd.size() + 1) * sizeof(char*));
+bool is_workspace(toml::Document const& config) {
+    return config.contains("workspace.members");
+}
+
+// a project listed in the [workspace] members of a spear.toml above it shares the
+// workspace settings and target directory
+void find_workspace() {
+    for (path dir = root.parent_path(); dir != dir.root_path(); dir = dir.parent_path()) {
+        if (!fs::exists(dir / "spear.toml"))
+            continue;
+
+        toml::Document config = toml::index(dir / "spear.toml");
+        if (!is_workspace(config))
+            continue;
+
+        bool member = false;
+        for (auto const& member_dir: toml::bind<WorkspaceConfig>(config, "workspace").value.members)
+            member |= fs::weakly_canonical(dir / member_dir) == fs::weakly_canonical(root);
+        if (member) {
+            workspace_root = dir;
+            workspace_config = config;
+        }
+        return;
+    }
+}
+
+void load_project(path const& dir) {
+    root = dir;
+    project_config = toml::index(root / "spear.toml");
+    find_project();
+    bind_settings();
+    // a member without its own cc uses the one of its workspace
+    if (!project_config.contains("project.cc") && settings.workspace.cc)
+        cc = *settings.workspace.cc;
 
-    for (size_t i=0; i<cmd.size(); i++) {
-        c_cmd[i] = (char*)malloc(cmd[i].size() * sizeof(char) + 1);
-        strcpy(c_cmd[i], cmd[i].c_str());
-        std::cout << cmd[i] << " ";
+    target_root = workspace_root.empty() ? root / "target" : workspace_root / "target" / project_name;
+}
+
+// the sections of the workspace, of the project over them and the machine ones over both
+void bind_settings() {
+    settings = {};
+    auto bind_document = [](toml::Document const& document, path const& file) {
+        bind_table(settings.compiler, document, file, "compiler");
+        bind_table(settings.debug, document, file, "debug");
+        bind_table(settings.bench, document, file, "bench");
+        bind_table(settings.pgo, document, file, "pgo");
+        bind_table(settings.cache, document, file, "cache");
+        bind_table(settings.distributed, document, file, "distributed");
+        bind_table(settings.workspace, document, file, "workspace");
+        for (auto const& name: document.subtables("profile"))
+            bind_table(settings.profiles[name], document, file, "profile." + name);
+    };
+
+    if (!workspace_root.empty() && workspace_root != root)
+        bind_document(workspace_config, workspace_root / "spear.toml");
+    bind_document(project_config, root / "spear.toml");
+    bind_table(settings.cache, global_config, global_config_path, "cache");
+    bind_table(settings.distributed, global_config, global_config_path, "distributed");
+}
+
+// the project settings, then the ones of its workspace
+toml::Document const& config_document(string const& key) {
+    if (!project_config.contains(key) && !workspace_root.empty())
+        return workspace_config;
+    return project_config;
+}
+
+std::optional<size_t> configured_jobs() {
+    if (cli_jobs)
+        return cli_jobs;
+    double count = settings.compiler.jobs.value_or(std::max(1u, std::thread::hardware_concurrency()));
+    if (count < 1) {
+        std::cout << "Error: [compiler] jobs should be at least 1, not " << count << std::endl;
+        return std::nullopt;
+    }
+    return count;
+}
+
+void m_execvp(strvec cmd) {
+    vector<char*> c_cmd;
+    for (auto& arg: cmd) {
+        c_cmd.push_back(arg.data());
+        std::cout << arg << " ";
     }
     std::cout << std::endl;
-    c_cmd[cmd.size()] = NULL;
+    c_cmd.push_back(NULL);
 
-    execvp(c_cmd[0], c_cmd);
+    execvp(c_cmd[0], c_cmd.data());
+    perror(c_cmd[0]);
 }
 
-strvec get_dependency_names() {
-    strvec dep_names;
-    auto deps = project_config["dependencies"];
-    if(!deps.has_value())
-        return dep_names;
-    auto dependencies = deps.value()->as<toml::Table>();
-
-    dependencies->foreach([&dep_names](string const& key, toml::Node* raw_dependency) {
-        dep_names.push_back(key);
-    });
+bool execute(strvec const& cmd) {
+    for (auto const& arg: cmd)
+        std::cout << arg << " ";
+    std::cout << std::endl;
+
+    auto process = runner::spawn(cmd);
+    return process && runner::wait(*process) == 0;
+}
 
-    return dep_names;
+strvec get_dependency_names() {
+    return project_config.subtables("dependencies");
 }
 
 strvec get_dependency_commands() {
     strvec dep_args;
-    auto deps = project_config["dependencies"];
-    if(!deps.has_value())
-        return dep_args;
-    auto dependencies = deps.value()->as<toml::Table>();
-
-    dependencies->foreach([&dep_args](string const& key, toml::Node* raw_dependency) {
-        auto dependency = raw_dependency->as<toml::Table>();
-
-        if( auto arr = dependency->get("commands").value()->as<toml::Array>() ) {
-            arr->foreach([&dep_args](toml::Node* arg) {
-                dep_args.push_back(arg->as<toml::String>()->_data);
-            });
-        }
-    });
-
+    for (auto const& name: get_dependency_names()) {
+        auto commands = project_config.get<strvec>("dependencies." + name + ".commands").value_or(strvec{});
+        dep_args.insert(dep_args.end(), commands.begin(), commands.end());
+    }
     return dep_args;
 }
 
@@ -149,57 +261,70 @@ void new_project(const int argc, char* argv[]) {
     f_spear << "[project]\n"
         << "name = '" << argv[1] << "'\n"
         << "version = '0.1.0'\n";
-    if (auto gcfg_cc = global_config["cc"])
-        f_spear << "cc = " << gcfg_cc.value() << "\n";
+    auto global = toml::bind<GlobalConfig>(global_config, "").value;
+    if (global.cc)
+        f_spear << "cc = '" << *global.cc << "'\n";
     else
         f_spear << "cc = 'g++'\n";
-    if (auto author = global_config["user"])
-        f_spear << "authors = [" << author.value() << "]\n";
+    if (global.user)
+        f_spear << "authors = ['" << *global.user << "']\n";
     f_spear.close();
 
     // create git repo
     std::cout << "create git repo" << std::endl;
-    pid_t pid = fork();
-    if (pid == 0) {
-        m_execvp({"git", "init", project_name.string()});
-        exit(0);
-    } else {
-        wait(NULL);
+    execute({"git", "init", project_name.string()});
 
-        std::ofstream of(project_name / ".gitignore");
-        of << "target" << std::endl;
-        of.close();
-    }
+    std::ofstream of(project_name / ".gitignore");
+    of << "target" << std::endl;
+    of.close();
 }
 
-bool newer_header(fs::path const& src_file, fs::file_time_type const time) {
-    std::ifstream infile(src_file);
+vector<Include> scan_includes(path const& file) {
+    std::ifstream infile(file);
 
-    strvec headers;
+    vector<Include> includes;
     string line;
-    const string include_prefix = "#include \"";
-    const char include_suffix = '"';
+    const string include_prefix = "#include ";
 
     while (getline(infile, line)) {
         const size_t prefix_pos = line.find(include_prefix);
 
         if (prefix_pos != string::npos) {
-            const size_t suffix_pos = line.find(include_suffix, prefix_pos + include_prefix.length());
+            const size_t open_pos = line.find_first_not_of(' ', prefix_pos + include_prefix.length());
+            if (open_pos == string::npos || (line[open_pos] != '"' && line[open_pos] != '<'))
+                continue;
+
+            const char include_suffix = line[open_pos] == '"' ? '"' : '>';
+            const size_t suffix_pos = line.find(include_suffix, open_pos + 1);
 
             if (suffix_pos != string::npos) {
-                const string include_path = line.substr(prefix_pos + include_prefix.length(), suffix_pos - prefix_pos - include_prefix.length());
-                headers.push_back(include_path);
+                const string include_path = line.substr(open_pos + 1, suffix_pos - open_pos - 1);
+                includes.push_back({include_path, include_suffix == '>'});
             }
         }
     }
+    return includes;
+}
 
+vector<path> local_headers(path const& src_file) {
+    vector<path> header_paths;
     const fs::path path = src_file.parent_path();
-    for (auto const& header: headers) {
-        auto header_path = path/header;
+    for (auto const& include: scan_includes(src_file)) {
+        if (include.system)
+            continue;
+
+        auto header_path = path/include.name;
 
         if (!fs::exists(header_path))
-            header_path = root/"src"/header;
+            header_path = root/"src"/include.name;
 
+        header_paths.push_back(header_path);
+    }
+    return header_paths;
+}
+
+bool newer_header(fs::path const& src_file, fs::file_time_type const time) {
+    for (auto const& header_path: local_headers(src_file)) {
         if (fs::last_write_time(header_path) >= time) {
             return true;
         }
@@ -207,95 +332,405 @@ bool newer_header(fs::path const& src_file, fs::file_time_type const time) {
     return false;
 }
 
-strvec build_objects(string base_output_dir, strvec& cmd_args) {
-    fs::current_path(root / "src");
-    path output_dir(root / base_output_dir);
-    strvec args = {cc};
-    auto dependencies = get_dependency_commands();
-    args.insert(args.end(), dependencies.begin(), dependencies.end());
+// the files written by a compile
+static vector<path> compile_outputs(path const& object, strvec const& args) {
+    if (has_split_dwarf(args))
+        return {object, dwo_file(object)};
+    return {object};
+}
+
+struct CompilePlan {
+    path src_dir;
+    path output_dir;
+    vector<CompileUnit> units;
+    std::unique_ptr<cache::Backend> cache_backend;
+    path cache_dir;
+    vector<string> cache_keys;
+    History history;
+    vector<size_t> compiled;
+};
+
+CompileUnits compile_units(path const& src_dir, path const& output_dir, strvec const& cmd_args, path const& bmi_dir) {
+    fs::current_path(src_dir);
+
+    CompileUnits found{{}, {}, false};
+    auto& units = found.units;
 
-    std::cout << "BUILDING" << std::endl;
     for (auto& src_file: fs::recursive_directory_iterator{"."}) {
-        if(src_file.is_directory()) {
-            fs::create_directory(output_dir / src_file.path());
+        string white_list[] = {".c", ".cpp", ".c++", ".cxx", ".cppm", ".ixx", ".mpp"};
+        if (src_file.is_directory() || std::find(std::begin(white_list), std::end(white_list), src_file.path().extension()) == std::end(white_list))
             continue;
+
+        path object = (output_dir / src_file.path().parent_path() / src_file.path().stem().concat(".o")).lexically_normal();
+        units.push_back({src_file.path(), object, scan_modules(src_file.path()), {}, false});
+    }
+
+    // module name -> unit providing its interface
+    auto& interfaces = found.interfaces;
+    bool& use_modules = found.use_modules;
+    for (size_t i = 0; i < units.size(); i++) {
+        if (!units[i].modules.provides.empty())
+            interfaces[units[i].modules.provides] = i;
+        use_modules |= !units[i].modules.provides.empty() || !units[i].modules.imports.empty();
+    }
+
+    strvec base_args = cmd_args;
+    if (use_modules) {
+        strvec modules;
+        for (auto const& [module, unit]: interfaces)
+            modules.push_back(module);
+
+        auto flags = module_args(bmi_dir, modules);
+        base_args.insert(base_args.end() - 1, flags.begin(), flags.end());
+    }
+
+    // cached objects are shared between checkouts, their debug info points in the project
+    if (cache::open())
+        base_args.insert(base_args.end() - 1, "-ffile-prefix-map=" + root.string() + "=.");
+
+    for (auto& unit: units) {
+        unit.args = base_args;
+        unit.args.push_back(unit.object);
+        if (use_modules) {
+            auto flags = module_interface_args(bmi_dir, unit.src_file, unit.modules);
+            unit.args.insert(unit.args.end(), flags.begin(), flags.end());
         }
+        unit.args.push_back(unit.src_file);
+    }
+    return found;
+}
 
-        string white_list[] = {".c", ".cpp", "c++", "cxx"};
-        if (std::find(std::begin(white_list), std::end(white_list), src_file.path().extension()) == std::end(white_list))
-            continue;
+std::shared_ptr<CompilePlan> plan_compile(runner::JobPool& pool, path const& src_dir, path const& output_dir, strvec const& cmd_args, path const& bmi_dir) {
+    auto plan = std::make_shared<CompilePlan>();
+    plan->src_dir = src_dir;
+    plan->output_dir = output_dir;
+
+    auto found = compile_units(src_dir, output_dir, cmd_args, bmi_dir);
+    plan->units = std::move(found.units);
+    auto& units = plan->units;
+    auto& interfaces = found.interfaces;
+    bool use_modules = found.use_modules;
+    plan->cache_backend = cache::open();
+    auto& cache_backend = plan->cache_backend;
+
+    for (auto& unit: units) {
+        fs::create_directories(unit.object.parent_path());
+
+        // the stamp holds the compile command, changing the profile flags rebuilds the object
+        unit.stale = !up_to_date(unit.object, {unit.src_file}, unit.args)
+            || newer_header(unit.src_file, fs::last_write_time(unit.object));
+
+        if (!unit.modules.provides.empty() && !fs::exists(module_interface(bmi_dir, unit.modules.provides)))
+            unit.stale = true;
+        if (has_split_dwarf(unit.args) && !fs::exists(dwo_file(unit.object)))
+            unit.stale = true;
+    }
+
+    // a rebuilt module interface invalidates every unit importing it
+    for (bool changed = use_modules; changed;) {
+        changed = false;
+        for (auto& unit: units) {
+            for (auto const& module: unit.modules.imports) {
+                if (unit.stale || !interfaces.count(module) || !units[interfaces[module]].stale)
+                    continue;
+                unit.stale = true;
+                changed = true;
+            }
+        }
+    }
+
+    // stale objects found in the shared cache are downloaded at once instead of compiled, units
+    // of modules are left out as their interfaces would have to be cached too
+    path cache_dir = plan->cache_dir = output_dir / ".cache";
+    auto& cache_keys = plan->cache_keys;
+    cache_keys.resize(units.size());
+    if (cache_backend) {
+        vector<size_t> cached;
+        vector<std::pair<path, strvec>> signatures;
+        for (size_t i = 0; i < units.size(); i++) {
+            if (!units[i].stale || !units[i].modules.provides.empty() || !units[i].modules.imports.empty())
+                continue;
+            cached.push_back(i);
+            signatures.push_back({units[i].src_file, units[i].args});
+        }
 
-        string object_file = output_dir / src_file.path().parent_path() / src_file.path().stem().concat(".o");
-        args.push_back(object_file);
+        vector<cache::Entry> wanted;
+        auto found = cache::keys(signatures, cache_dir);
+        for (size_t k = 0; k < cached.size(); k++) {
+            cache_keys[cached[k]] = found[k];
+            if (!found[k].empty())
+                wanted.push_back({found[k], cache_dir / found[k]});
+        }
 
-        auto object_path = path{object_file};
-        auto const last_src_write = fs::last_write_time(src_file);
-        if( fs::exists(object_path) ) {
-            auto const last_obj_write = fs::last_write_time(object_path);
-            if (last_obj_write > last_src_write && !newer_header(src_file, last_obj_write) )
+        cache_backend->get(wanted);
+        for (size_t i = 0; i < units.size(); i++) {
+            path artifact = cache_dir / cache_keys[i];
+            if (cache_keys[i].empty() || !fs::exists(artifact))
                 continue;
+            if (cache::restore(artifact, compile_outputs(units[i].object, units[i].args))) {
+                std::cout << "CACHED " << units[i].src_file.string() << std::endl;
+                write_stamp(units[i].object, units[i].args);
+                units[i].stale = false;
+            }
+            fs::remove(artifact);
         }
+    }
 
-        pid_t pid = fork();
-        if (pid == 0) {
-            cmd_args.push_back(object_file);
-            cmd_args.push_back(src_file.path());
+    // module interfaces are compiled before their importers, everything else in parallel
+    vector<size_t> job_of(units.size());
+    for (size_t i = 0, next_job = pool.jobs.size(); i < units.size(); i++) {
+        if (units[i].stale)
+            job_of[i] = next_job++;
+    }
 
-            m_execvp(cmd_args);
-            exit(0);
-        } else {
-            wait(NULL);
+    // the slowest units of the last build start first, heavy units wait for memory to free
+    // up while lighter ones keep the other job slots busy
+    plan->history = load_history(output_dir);
+
+    // a unit sent to a [distributed] worker only preprocesses here, its usage is not the one
+    // of the compile. It takes one of the worker slots, the local ones stay for the other
+    // units and the ones no worker compiled.
+    size_t remote_slots = 0;
+    for (auto const& host: worker::reachable())
+        remote_slots += host.slots;
+    if (remote_slots > 0)
+        pool.remote_jobs = remote_slots;
+
+    for (size_t i = 0; i < units.size(); i++) {
+        CompileUnit const& unit = units[i];
+        if (!unit.stale)
+            continue;
+
+        bool remote = remote_slots > 0 && worker::distributable(unit.args, use_modules);
+
+        JobStats expected = expected_stats(plan->history, unit.object);
+        runner::Job job{remote ? worker::command(unit.args) : unit.args, [object = unit.object, args = unit.args, plan = plan.get(), i, remote](struct rusage const& usage, size_t wall_ms) {
+            write_stamp(object, args);
+            plan->compiled.push_back(i);
+            if (remote)
+                return;
+            plan->history[object].rss = usage.ru_maxrss;
+            plan->history[object].ms = wall_ms;
+        }, {}, remote ? 0 : expected.rss, expected.ms, src_dir, remote, unit.args};
+
+        for (auto const& module: unit.modules.imports) {
+            if (interfaces.count(module) && interfaces[module] != i && units[interfaces[module]].stale)
+                job.deps.push_back(job_of[interfaces[module]]);
         }
+        pool.add(job);
     }
 
     fs::current_path(root);
-    args.push_back("-o");
-    return args;
+    return plan;
 }
 
-void build(const int argc, char* argv[]) {
-    path target_dir(root / "target");
-    path target;
-    strvec build_args;
+std::optional<strvec> finish_compile(CompilePlan& plan, bool success) {
+    save_history(plan.output_dir, plan.history);
+
+    // even a failed build shares the objects it compiled
+    auto const& units = plan.units;
+    if (plan.cache_backend && cache::writable()) {
+        path const& cache_dir = plan.cache_dir;
+        auto const& cache_keys = plan.cache_keys;
+        vector<cache::Entry> artifacts;
+        for (size_t i: plan.compiled) {
+            if (!cache_keys[i].empty() && cache::pack(compile_outputs(units[i].object, units[i].args), cache_dir / cache_keys[i]))
+                artifacts.push_back({cache_keys[i], cache_dir / cache_keys[i]});
+        }
+        plan.cache_backend->put(artifacts);
+        for (auto const& artifact: artifacts)
+            fs::remove(artifact.file);
+    }
+
+    if (!success)
+        return std::nullopt;
+    strvec objects;
+    for (auto const& unit: units)
+        objects.push_back(unit.object);
+    return objects;
+}
 
-    fs::create_directory(target_dir);
+std::optional<strvec> compile_objects(path const& src_dir, path const& output_dir, strvec const& cmd_args, path const& bmi_dir) {
+    worker::probe();
+    runner::JobPool pool(jobs, memory_budget());
+    auto plan = plan_compile(pool, src_dir, output_dir, cmd_args, bmi_dir);
+    bool success = pool.run();
+    return finish_compile(*plan, success);
+}
+
+string profile_name(const int argc, char* argv[], string const& fallback) {
+    if (argc >= 2 && string(argv[1]) != "with")
+        return argv[1];
+    return fallback;
+}
+
+// debug builds instrumented at compile and link time, each in its own target/<name>/
+std::map<string, strvec> instrumented_profiles = {
+    {"asan", {"-fsanitize=address", "-fno-omit-frame-pointer"}},
+    {"ubsan", {"-fsanitize=undefined", "-fno-sanitize-recover=undefined"}},
+    {"tsan", {"-fsanitize=thread"}},
+    {"coverage", {"-O0", "--coverage"}},
+};
+
+std::optional<Profile> find_profile(string const& name, int depth) {
+    Profile profile{name, {}, {}, {}};
+
+    if (name == "release") {
+        profile.options = {"-O3"};
+    }
+    else if (name == "debug") {
+        profile.options = {"-fdiagnostics-color=always", "-Og", "-g3", "-Wall"};
+        add_debug_info_options(profile);
+    }
+    else if (instrumented_profiles.count(name)) {
+        profile = *find_profile("debug", depth + 1);
+        profile.name = name;
 
-    if (argc >= 2 && string(argv[1]) == "release") {
-        target_dir /= "release";
-        build_args = {cc, "-I.", "-c", "-O3", "-std=c++20", "-o"};
+        auto const& flags = instrumented_profiles[name];
+        profile.options.insert(profile.options.end(), flags.begin(), flags.end());
+        profile.link_options.insert(profile.link_options.end(), flags.begin(), flags.end());
+    }
+    else if (settings.profiles.count(name) && depth < 16) {
+        auto parent = find_profile(settings.profiles[name].inherits, depth + 1);
+        if (!parent)
+            return std::nullopt;
+
+        profile.options = parent->options;
+        profile.link_options = parent->link_options;
+        profile.targets = parent->targets;
     }
     else {
-        target_dir /= "debug";
-        build_args = {cc, "-fdiagnostics-color=always", "-I.", "-c", "-Og", "-g3", "-Wall", "-std=c++20", "-o"};
+        return std::nullopt;
     }
 
-    fs::create_directory(target_dir);
+    auto found = settings.profiles.find(name);
+    if (found == settings.profiles.end())
+        return profile;
+
+    ProfileConfig const& config = found->second;
+    if (!config.targets.empty())
+        profile.targets = config.targets;
+    profile.options.insert(profile.options.end(), config.options.begin(), config.options.end());
+    profile.link_options.insert(profile.link_options.end(), config.link_options.begin(), config.link_options.end());
+    return profile;
+}
+
+strvec profile_args(Profile const& profile) {
+    strvec args = {cc, "-I.", "-c", "-std=c++20"};
+    args.insert(args.end(), profile.options.begin(), profile.options.end());
+    args.push_back("-o");
+    return args;
+}
+
+path make_target_dir(string const& profile) {
+    path target_dir(target_root);
+    fs::create_directories(target_dir);
+
+    target_dir /= profile;
+    fs::create_directories(target_dir);
     fs::create_directory(target_dir / "object");
     fs::create_directory(target_dir / "build");
-    target = target_dir / "build" / project_name;
+    return target_dir;
+}
+
+bool build_profile(Profile const& profile, path target) {
+    path target_dir = make_target_dir(profile.name);
+    if (target.empty())
+        target = target_dir / "build" / project_name;
+    strvec build_args = profile_args(profile);
 
-    auto args = build_objects(target_dir / "object", build_args);
-    args.push_back(root / target);
+    std::cout << "BUILDING" << std::endl;
+    auto objects = compile_objects(root / "src", target_dir / "object", build_args, target_dir / "bmi");
+    if (!objects) {
+        std::cout << "Error: could not build " << project_name << " (" << profile.name << ")" << std::endl;
+        return false;
+    }
 
     std::cout << "LINKING" << std::endl;
-    m_execvp(args);
+    return link_objects(target_dir / "object", *objects, target, profile.link_options);
 }
 
-void run(const int argc, char* argv[]) {
-    pid_t pid = fork();
-    if (pid == 0) {
-        build(argc, argv);
-        exit(0);
+strvec build_programs(Profile const& profile, path const& src_dir, string const& kind, size_t* failures) {
+    path target_dir = make_target_dir(profile.name);
+    path object_dir = target_dir / "object";
+    strvec args = profile_args(profile);
+
+    std::cout << "BUILDING" << std::endl;
+    auto objects = compile_objects(root / "src", object_dir, args, target_dir / "bmi");
+    if (!objects) {
+        if (failures)
+            (*failures)++;
+        return {};
     }
-    else {
-        wait(NULL);
+
+    // the project entry point would clash with the programs ones
+    path main_object = object_dir / "main.o";
+    std::erase_if(*objects, [&main_object](string const& object) {
+        return path(object) == main_object;
+    });
+
+    path programs_dir = target_dir / kind;
+    fs::create_directories(programs_dir / "object");
+
+    strvec program_args = args;
+    program_args.insert(program_args.begin() + 1, "-I" + (root / "src").string());
+    auto program_objects = compile_objects(src_dir, programs_dir / "object", program_args, target_dir / "bmi");
+    if (!program_objects) {
+        if (failures)
+            (*failures)++;
+        return {};
+    }
+
+    strvec executables;
+
+    std::cout << "LINKING" << std::endl;
+    for (auto const& program_object: *program_objects) {
+        path executable = programs_dir / path(program_object).stem();
+
+        strvec inputs = {program_object};
+        inputs.insert(inputs.end(), objects->begin(), objects->end());
+
+        if (link_objects(object_dir, inputs, executable, profile.link_options))
+            executables.push_back(executable);
+        else {
+            std::cout << "Error: failed to link " << executable.filename().string() << std::endl;
+            if (failures)
+                (*failures)++;
+        }
     }
 
+    return executables;
+}
+
+bool build_named(string const& name) {
+    if (name == "pgo")
+        return build_pgo();
+
+    auto profile = find_profile(name);
+    if (!profile) {
+        std::cout << "Error: unknown profile '" << name << "'" << std::endl
+                  << "You may want to add a [profile." << name << "] section to spear.toml" << std::endl;
+        return false;
+    }
+
+    if (!profile->targets.empty())
+        return build_variants(*profile);
+    return build_profile(*profile);
+}
+
+void build(const int argc, char* argv[]) {
+    string name = profile_name(argc, argv, "debug");
+    if (!(workspace_root == root ? build_workspace(name) : build_named(name)))
+        exit(1);
+}
+
+void run(const int argc, char* argv[]) {
+    if (!build_named(profile_name(argc, argv, "debug")))
+        exit(1);
+
     strvec commands;
 
-    fs::path target = (argc >= 2 && string(argv[1]) == "release")
-        ? root / "target" / "release" / "build" / project_name
-        : root / "target" / "debug" / "build" / project_name;
+    fs::path target = target_root / profile_name(argc, argv, "debug") / "build" / project_name;
     commands.push_back(target);
 
     int with_position = 0;
@@ -315,7 +750,7 @@ void run(const int argc, char* argv[]) {
 }
 
 void clean() {
-    fs::remove_all(root / "target");
+    fs::remove_all(target_root);
 }
 
 void package(const int argc, char* argv[]) {
@@ -346,14 +781,20 @@ void add(const int argc, char* argv[]) {
         }
     }
 
-    if (auto maybe_commands = lib_configs[lib_name+".commands"]) {
-        auto commands = maybe_commands.value()->as<toml::Array>();
+    auto lib = find_lib(lib_name);
+    if (lib && !lib->commands.empty()) {
+        auto commands = new toml::Array;
+        for (auto const& command: lib->commands)
+            commands->push(new toml::String(command));
 
-        project_config.value_or("dependencies."+lib_name, new toml::Table)
+        // the only commands writing spear.toml, the whole document is built for them
+        toml::Table config = toml::parse(root / "spear.toml");
+        config.value_or("dependencies."+lib_name, new toml::Table)
             ->as<toml::Table>()
             ->set("commands", commands);
 
-        std::ofstream(root / "spear.toml") << project_config;
+        std::ofstream(root / "spear.toml") << config;
+        project_config = toml::index(root / "spear.toml");
     }
 
     if(argc > 4)
@@ -371,25 +812,24 @@ void enable_feature(const int argc, char **argv) {
         return;
     }
 
+    toml::Table config = toml::parse(root / "spear.toml");
     for (int i = 2; i < argc; i++) {
         string feature = argv[i];
-        auto commands_maybe = lib_configs[lib+"."+feature+".commands"];
-        if(!commands_maybe.has_value())
+        auto feature_config = find_lib(lib+"."+feature);
+        if(!feature_config)
             continue;
 
-        auto commands = commands_maybe.value()->as<toml::Array>();
-
-        commands->foreach([&lib] (toml::Node* command) {
-            if(auto lib_config = project_config["dependencies."+lib]) {
+        for (auto const& command: feature_config->commands) {
+            if(auto lib_config = config["dependencies."+lib]) {
                 lib_config.value()->as<toml::Table>()
                     ->get("commands").value()
                     ->as<toml::Array>()->_data
-                    .push_back(command);
+                    .push_back(new toml::String(command));
             }
-        });
+        }
     }
 
-    std::ofstream(root / "spear.toml") << project_config;
+    std::ofstream(root / "spear.toml") << config;
 }
 
 void install(const int argc, char* argv[]) {
@@ -399,28 +839,65 @@ void install(const int argc, char* argv[]) {
         ? xdg_data_home / "spear" / "bin"
         : home / ".local"/"share"/"spear"/"bin";
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        if(argc < 2) {
-            char* args[] = {"install", "release"};
-            build(2, args);
-        }
-        else build(argc, argv);
-        exit(0);
+    string profile = profile_name(argc, argv, "release");
+    if (!build_named(profile))
+        exit(1);
+
+    path target_dir = target_root / profile;
+    path target = target_dir / "build" / project_name;
+    if (!install_binary(target, target_dir / "object", bin_path)) {
+        std::cout << "Error: could not install " << project_name << std::endl;
+        exit(1);
     }
-    else {
-        wait(NULL);
+
+    // multi versioned builds come with one binary per cpu level next to the dispatcher
+    path variants = target;
+    variants += ".d";
+    if (!fs::exists(variants))
+        return;
+    for (auto const& entry: fs::directory_iterator{variants}) {
+        string level = entry.path().filename();
+        if (level.starts_with("."))
+            continue;   // link stamps
+        if (!install_binary(entry.path(), target_dir / level / "object", bin_path / variants.filename())) {
+            std::cout << "Error: could not install " << project_name << " (" << level << ")" << std::endl;
+            exit(1);
+        }
     }
+}
 
-    fs::path target = (argc >= 2 && string(argv[1]) == "debug")
-        ? root / "target" / "debug" / "build" / project_name
-        : root / "target" / "release" / "build" / project_name;
-    m_execvp({"cp", target, bin_path});
+// removes -j<n> / -j <n> (anywhere before 'with') and returns n, nullopt when absent and 0
+// when the value is not a positive number
+std::optional<size_t> strip_jobs_option(vector<char*>& args) {
+    std::optional<size_t> requested_jobs;
+    for (size_t i = 0; i < args.size() && string(args[i]) != "with"; i++) {
+        string arg = args[i];
+        if (!arg.starts_with("-j"))
+            continue;
+
+        string value = arg.size() > 2 ? arg.substr(2) : i + 1 < args.size() ? string(args[i + 1]) : "";
+        args.erase(args.begin() + i, args.begin() + std::min(args.size(), i + (arg.size() > 2 ? 1 : 2)));
+        i--;
+
+        size_t count = 0;
+        auto parsed = std::from_chars(value.data(), value.data() + value.size(), count);
+        requested_jobs = parsed.ec == std::errc() && parsed.ptr == value.data() + value.size() ? count : 0;
+    }
+    return requested_jobs;
 }
 
 void spear(const int argc, char* argv[]) {
+    vector<char*> args(argv, argv + argc);
+    if (auto requested_jobs = strip_jobs_option(args)) {
+        CHECK((*requested_jobs == 0), man::spear)
+        cli_jobs = *requested_jobs;
+        spear(args.size(), args.data());
+        return;
+    }
+
     CHECK((argc < 2), man::spear)
     string argv1(argv[1]);
+    spear_exe = fs::read_symlink("/proc/self/exe");
     find_global_config();
 
     if (argv1 == "new") {
@@ -428,16 +905,66 @@ void spear(const int argc, char* argv[]) {
         return;
     }
 
+    if (argv1 == "cache") {
+        cache_command(argc - 1, argv + 1);
+        return;
+    }
+
+    if (argv1 == "worker") {
+        worker_command(argc - 1, argv + 1);
+        return;
+    }
+
     find_root();
+    if (argv1 == "server") {
+        server(argc - 1, argv + 1);
+        return;
+    }
+
     find_project_config();
     find_lib_configs();
-    find_project_name();
-    if (auto lcfg_cc = project_config["project.cc"])
-        cc = lcfg_cc.value()->as<toml::String>()->_data;
+
+    // the root of a workspace builds its members, it is not a project
+    if (is_workspace(project_config)) {
+        workspace_root = root;
+        workspace_config = project_config;
+        target_root = root / "target";
+        bind_settings();
+        if (auto count = configured_jobs())
+            jobs = *count;
+        else
+            exit(1);
+
+        if (argv1 == "build")
+            build(argc - 1, argv + 1);
+        else if (argv1 == "clean")
+            clean();
+        else if (argv1 == "gen") {
+            // the members build in one pool with their own graphs, each member generates its own
+            std::cout << "Error: spear gen does not support a workspace root, run it in each of its members" << std::endl;
+            exit(1);
+        }
+        else
+            std::cout << "Error: " << root.string() << " is a workspace, " << argv1 << " runs in one of its members" << std::endl;
+        return;
+    }
+
+    find_workspace();
+    load_project(root);
+    if (auto count = configured_jobs())
+        jobs = *count;
+    else
+        exit(1);
 
     if (argv1 == "run")
         run(argc - 1, argv+1);
 
+    else if (argv1 == "bench")
+        bench(argc - 1, argv+1);
+
+    else if (argv1 == "test")
+        test(argc - 1, argv+1);
+
     else if (argv1 == "build")
         build(argc - 1, argv+1);
 
@@ -459,6 +986,12 @@ void spear(const int argc, char* argv[]) {
     else if (argv1 == "install")
         install(argc - 1, argv+1);
 
+    else if (argv1 == "gen")
+        gen(argc - 1, argv+1);
+
+    else if (argv1 == "analyze")
+        analyze(argc - 1, argv+1);
+
     else if (argv1 == "get_name")
         std::cout << project_name << std::endl;
 
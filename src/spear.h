@@ -1,13 +1,337 @@
 #pragma once
 
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include "toml/toml.h"
+#include "toml/bind.h"
+
+// [project] of spear.toml
+struct ProjectConfig {
+    std::string name;
+    std::string version;
+    std::string cc = "g++";
+    std::vector<std::string> authors;
+};
+
+template<> struct toml::Schema<ProjectConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"name", &ProjectConfig::name},
+        Field{"version", &ProjectConfig::version},
+        Field{"cc", &ProjectConfig::cc},
+        Field{"authors", &ProjectConfig::authors},
+    };
+};
+
+// a [lib] (or [lib.feature]) table of libs.toml
+struct LibEntry {
+    std::string url;
+    std::vector<std::string> commands;
+    std::vector<std::string> fetched;
+};
+
+template<> struct toml::Schema<LibEntry> {
+    static constexpr auto fields = std::tuple{
+        Field{"url", &LibEntry::url},
+        Field{"commands", &LibEntry::commands},
+        Field{"fetched", &LibEntry::fetched},
+    };
+};
+
+// the root keys of the global spear.toml
+struct GlobalConfig {
+    std::optional<std::string> user;
+    std::optional<std::string> cc;
+};
+
+template<> struct toml::Schema<GlobalConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"user", &GlobalConfig::user},
+        Field{"cc", &GlobalConfig::cc},
+    };
+};
+
+// [workspace], members = [] for a project
+struct WorkspaceConfig {
+    std::vector<std::string> members;
+    std::optional<std::string> cc;      // of the members without their own [project] cc
+};
+
+template<> struct toml::Schema<WorkspaceConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"members", &WorkspaceConfig::members},
+        Field{"cc", &WorkspaceConfig::cc},
+    };
+};
+
+struct CompilerConfig {
+    std::string linker = "auto";
+    std::optional<double> jobs;
+    double memory = 0;                  // MiB, 0 for the memory found on the machine
+};
+
+template<> struct toml::Schema<CompilerConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"linker", &CompilerConfig::linker},
+        Field{"jobs", &CompilerConfig::jobs},
+        Field{"memory", &CompilerConfig::memory},
+    };
+};
+
+struct DebugConfig {
+    double split = 1;
+    double gdb_index = 1;
+    std::string compress = "zlib";
+};
+
+template<> struct toml::Schema<DebugConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"split", &DebugConfig::split},
+        Field{"gdb_index", &DebugConfig::gdb_index},
+        Field{"compress", &DebugConfig::compress},
+    };
+};
+
+struct BenchConfig {
+    double warmup = 3;
+    double runs = 10;
+    double threshold = 5;
+};
+
+template<> struct toml::Schema<BenchConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"warmup", &BenchConfig::warmup},
+        Field{"runs", &BenchConfig::runs},
+        Field{"threshold", &BenchConfig::threshold},
+    };
+};
+
+struct PgoConfig {
+    std::string inherits = "release";
+    std::vector<std::string> train;
+    std::vector<std::string> command;
+    std::optional<std::string> lto;     // the default depends on the compiler
+};
+
+template<> struct toml::Schema<PgoConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"inherits", &PgoConfig::inherits},
+        Field{"train", &PgoConfig::train},
+        Field{"command", &PgoConfig::command},
+        Field{"lto", &PgoConfig::lto},
+    };
+};
+
+struct CacheConfig {
+    std::string url;
+    std::string mode = "read-write";
+};
+
+template<> struct toml::Schema<CacheConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"url", &CacheConfig::url},
+        Field{"mode", &CacheConfig::mode},
+    };
+};
+
+struct DistributedConfig {
+    std::vector<std::string> workers;
+};
+
+template<> struct toml::Schema<DistributedConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"workers", &DistributedConfig::workers},
+    };
+};
+
+// a [profile.<name>] table
+struct ProfileConfig {
+    std::string inherits = "debug";
+    std::vector<std::string> options;
+    std::vector<std::string> link_options;
+    std::vector<std::string> targets;   // empty keeps the ones of the inherited profile
+};
+
+template<> struct toml::Schema<ProfileConfig> {
+    static constexpr auto fields = std::tuple{
+        Field{"inherits", &ProfileConfig::inherits},
+        Field{"options", &ProfileConfig::options},
+        Field{"link_options", &ProfileConfig::link_options},
+        Field{"targets", &ProfileConfig::targets},
+    };
+};
+
+// the sections of spear.toml, bound once when the project is loaded. A key of the project
+// replaces the one of its workspace, [cache] and [distributed] of the global spear.toml
+// replace both.
+struct Settings {
+    CompilerConfig compiler;
+    DebugConfig debug;
+    BenchConfig bench;
+    PgoConfig pgo;
+    CacheConfig cache;
+    DistributedConfig distributed;
+    WorkspaceConfig workspace;
+    std::map<std::string, ProfileConfig> profiles;
+};
+
+// project state, loaded by spear() before any command runs
+extern std::string cc;
+extern size_t jobs;
+extern std::filesystem::path root;
+extern toml::Document project_config;
+extern std::string project_name;
+extern std::filesystem::path target_root;      // target/, <workspace>/target/<name>/ for workspace members
+extern std::filesystem::path workspace_root;   // empty outside of a workspace
+
+extern toml::Document workspace_config;
+extern Settings settings;
+
+// the spear program jobs run (remote compiles, the ninja generator). Set by spear(), a
+// program using libspear sets it or spear is looked up in PATH.
+extern std::filesystem::path spear_exe;
+std::filesystem::path spear_executable();
+
+void find_global_config();
+void find_lib_configs();
+std::optional<LibEntry> find_lib(std::string const& name);
+void find_root();
+void find_project_config();
+void find_workspace();
+bool is_workspace(toml::Document const& config);
+bool is_clang();
+void load_project(std::filesystem::path const& dir);
+void bind_settings();
+// the document holding a key, the project one or its workspace one
+toml::Document const& config_document(std::string const& key);
+// the compilers running at once: -j, [compiler] jobs or the cpu count. nullopt (the error
+// printed) when [compiler] jobs is below 1
+std::optional<size_t> configured_jobs();
+
+void m_execvp(std::vector<std::string> cmd);
+bool execute(std::vector<std::string> const& cmd);
+std::vector<std::string> get_dependency_commands();
+// compile and link flags of a build profile, objects live in target/<name>/
+struct Profile {
+    std::string name;
+    std::vector<std::string> options;
+    std::vector<std::string> link_options;
+    std::vector<std::string> targets;   // -march levels, one binary each
+};
+
+std::string profile_name(const int argc, char* argv[], std::string const& fallback);
+std::optional<Profile> find_profile(std::string const& name, int depth = 0);
+std::vector<std::string> profile_args(Profile const& profile);
+std::filesystem::path make_target_dir(std::string const& profile);
+// c++20 module declarations of a source file
+struct ModuleInfo {
+    std::string provides;               // module (or module:partition) whose interface it compiles
+    std::vector<std::string> imports;
+};
+
+struct CompileUnit {
+    std::filesystem::path src_file;     // relative to the source tree
+    std::filesystem::path object;
+    ModuleInfo modules;
+    std::vector<std::string> args;
+    bool stale;
+};
+
+// the sources of a tree with the command compiling each of them, in the source tree which
+// becomes the working directory. Module interfaces are indexed by their module name.
+struct CompileUnits {
+    std::vector<CompileUnit> units;
+    std::map<std::string, size_t> interfaces;
+    bool use_modules;
+};
+
+CompileUnits compile_units(std::filesystem::path const& src_dir, std::filesystem::path const& output_dir, std::vector<std::string> const& cmd_args, std::filesystem::path const& bmi_dir);
+// the #include "<name>" (or <name> for system) lines of a file
+struct Include {
+    std::string name;
+    bool system;
+};
+
+std::vector<Include> scan_includes(std::filesystem::path const& file);
+// the local headers a source includes, a change in one of them rebuilds it
+std::vector<std::filesystem::path> local_headers(std::filesystem::path const& src_file);
+
+// the compile jobs of a source tree go in a pool that may be shared with other trees,
+// finish_compile saves what the jobs recorded once the pool ran
+struct CompilePlan;
+namespace runner { struct JobPool; }
+std::shared_ptr<CompilePlan> plan_compile(runner::JobPool& pool, std::filesystem::path const& src_dir, std::filesystem::path const& output_dir, std::vector<std::string> const& cmd_args, std::filesystem::path const& bmi_dir);
+std::optional<std::vector<std::string>> finish_compile(CompilePlan& plan, bool success);
+std::optional<std::vector<std::string>> compile_objects(std::filesystem::path const& src_dir, std::filesystem::path const& output_dir, std::vector<std::string> const& cmd_args, std::filesystem::path const& bmi_dir);
+
+ModuleInfo scan_modules(std::filesystem::path const& src_file);
+std::filesystem::path module_interface(std::filesystem::path const& bmi_dir, std::string const& module);
+std::vector<std::string> module_args(std::filesystem::path const& bmi_dir, std::vector<std::string> const& modules);
+std::vector<std::string> module_interface_args(std::filesystem::path const& bmi_dir, std::filesystem::path const& src_file, ModuleInfo const& info);
+
+bool up_to_date(std::filesystem::path const& output, std::vector<std::string> const& inputs, std::vector<std::string> const& cmd);
+void write_stamp(std::filesystem::path const& output, std::vector<std::string> const& cmd);
+std::string select_linker();
+std::filesystem::path find_program(std::string const& program);    // empty when not in PATH
+
+// the commands of a link: a thin archive per sub directory of the objects, then the link
+struct Archive {
+    std::filesystem::path file;
+    std::vector<std::string> members;
+    std::vector<std::string> cmd;
+};
+
+struct LinkCommands {
+    std::vector<Archive> archives;
+    std::vector<std::string> inputs;    // objects and archives
+    std::vector<std::string> cmd;
+};
+
+LinkCommands link_commands(std::filesystem::path const& object_dir, std::vector<std::string> const& objects, std::filesystem::path const& output, std::vector<std::string> const& link_options);
+
+// resources used by a previous build of each output, kept in <output dir>/.history
+struct JobStats {
+    size_t rss = 0;     // peak KiB
+    size_t ms = 0;      // wall time, a multi threaded compile (-flto=auto) uses more cpu time
+};
+using History = std::map<std::string, JobStats>;
+History load_history(std::filesystem::path const& output_dir);
+void save_history(std::filesystem::path const& output_dir, History const& history);
+JobStats expected_stats(History const& history, std::string const& output);
+size_t memory_budget();
+// KiB, the part of the budget of a build running next to others (the forked variants), 0 for all of it
+extern size_t memory_share;
+bool link_objects(std::filesystem::path const& object_dir, std::vector<std::string> const& objects, std::filesystem::path const& output, std::vector<std::string> const& link_options);
+bool build_profile(Profile const& profile, std::filesystem::path target = {});
+bool build_variants(Profile const& profile);
+std::vector<std::string> build_programs(Profile const& profile, std::filesystem::path const& src_dir, std::string const& kind, size_t* failures = nullptr);
+bool build_pgo();
+bool build_named(std::string const& name);   // pgo, multi versioned or a plain profile build
+bool build_workspace(std::string const& name);
+
+// split dwarf, gdb index and compressed debug sections of the debug profile ([debug])
+void add_debug_info_options(Profile& profile);
+bool has_split_dwarf(std::vector<std::string> const& args);
+std::filesystem::path dwo_file(std::filesystem::path const& object);
+bool install_binary(std::filesystem::path const& binary, std::filesystem::path const& object_dir, std::filesystem::path const& dir);
 
 void new_project(const int argc, char* argv[]);
 void build(const int argc, char* argv[]);
 void run(const int argc, char* argv[]);
+void bench(const int argc, char* argv[]);
+void test(const int argc, char* argv[]);
 void package(const int argc, char* argv[]);
 void fetch(const int argc, char* argv[]);
 void add(const int argc, char* argv[]);
 void enable_feature(const int argc, char* argv[]);
 void install(const int argc, char* argv[]);
+void gen(const int argc, char* argv[]);
+void analyze(const int argc, char* argv[]);
+void cache_command(const int argc, char* argv[]);
+void worker_command(const int argc, char* argv[]);
+void server(const int argc, char* argv[]);
 void spear(const int argc, char* argv[]);
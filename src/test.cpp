@@ -0,0 +1,77 @@
+#include "spear.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "man.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+void test(const int argc, char* argv[]) {
+    string filter;
+    string name = "debug";
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--profile" && i + 1 < argc)
+            name = argv[++i];
+        else if (arg.starts_with("--")) {
+            std::cout << man::test << std::endl;
+            return;
+        }
+        else
+            filter = arg;
+    }
+
+    if (!fs::exists(root / "test")) {
+        std::cout << "Error: no test/ directory in " << root.string() << std::endl;
+        return;
+    }
+
+    auto profile = find_profile(name);
+    if (!profile) {
+        std::cout << "Error: unknown profile '" << name << "'" << std::endl;
+        return;
+    }
+
+    size_t failed = 0;
+    size_t passed = 0;
+    auto executables = build_programs(*profile, root / "test", "test", &failed);
+
+    // counters of previous runs would add up with this one
+    path target_dir = target_root / profile->name;
+    for (auto const& entry: fs::recursive_directory_iterator{target_dir}) {
+        if (entry.path().extension() == ".gcda")
+            fs::remove(entry.path());
+    }
+
+    std::cout << "TESTING" << std::endl;
+    fs::current_path(root);
+    for (auto const& executable: executables) {
+        string test_name = path(executable).filename();
+        if (!filter.empty() && test_name.find(filter) == string::npos)
+            continue;
+
+        if (execute({executable})) {
+            std::cout << "test " << test_name << " ... ok" << std::endl;
+            passed++;
+        }
+        else {
+            std::cout << "test " << test_name << " ... FAILED" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << passed << " passed, " << failed << " failed" << std::endl;
+    if (profile->name == "coverage")
+        std::cout << "coverage data: " << target_dir.string() << " (gcov, gcovr, lcov)" << std::endl;
+
+    if (failed)
+        exit(1);
+}
@@ -46,29 +46,40 @@ std::ostream& toml::operator<<(std::ostream& os, Array* n) {
     return os;
 }
 
-void Array::parse(str &line, sstr &&data, Table &root_table) {
-    std::regex re(ASSIGN);
-    std::sregex_token_iterator p(line.begin(), line.end(), re, -1);
-    str key = *p++;
-    str right = *p;
-    right.assign(right.begin()+1, right.end()-1);
+vec<str> Array::tokens(str const& value) {
+    str right(value.begin()+1, value.end()-1);
+
+    // the elements are separated by ',' and the spaces after it, a trailing separator
+    // does not add an element
+    vec<str> tokens;
+    size_t start = 0;
+    for (size_t comma = right.find(','); comma != str::npos; comma = right.find(',', start)) {
+        tokens.push_back(right.substr(start, comma - start));
+        start = std::min(right.find_first_not_of(' ', comma + 1), right.size());
+    }
+    if (start < right.size() || tokens.empty())
+        tokens.push_back(right.substr(start));
+    return tokens;
+}
+
+bool Array::is_number(str const& token) {
+    return !token.empty() && std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+str Array::unquote(str const& token) {
+    return token.size() < 2 ? "" : token.substr(1, token.size() - 2);
+}
+
+void Array::parse(str const& line, Table& table) {
+    auto [key, value] = split_assign(line);
 
     Array *array = new Array;
-    std::regex re2(", *");
-    std::sregex_token_iterator p2(right.begin(), right.end(), re2, -1);
-    std::sregex_token_iterator end;
-
-    std::regex number("[0-9]+");
-    while (p2 != end) {
-        str token = *p2++;
-        if (std::regex_match(token, number))
+    for (auto const& token: tokens(value)) {
+        if (is_number(token))
             array->push(new Number(token));
-        else{
-            token.assign(token.begin()+1, token.end()-1);
-            array->push(new String(token));
-        }
+        else
+            array->push(new String(unquote(token)));
     }
 
-    root_table.set_if_not(key, array);
+    table.set_if_not(key, array);
 }
-
@@ -0,0 +1,102 @@
+#include "bind.h"
+
+#include <algorithm>
+
+using namespace toml;
+
+std::ostream& toml::operator<<(std::ostream& os, Error const& error) {
+    os << "line " << error.line << ": " << error.key << " should be " << error.expected;
+    return os;
+}
+
+// the values are read like String::parse, Number::parse and Array::parse read them
+
+bool toml::read_value(Entry const& entry, str& value) {
+    if (entry.kind != Kind::string)
+        return false;
+    value = String::unquote(split_assign(str(entry.text)).second);
+    return true;
+}
+
+bool toml::read_value(Entry const& entry, double& value) {
+    if (entry.kind != Kind::number)
+        return false;
+    value = Number(split_assign(str(entry.text)).second)._data;
+    return true;
+}
+
+bool toml::read_value(Entry const& entry, vec<str>& value) {
+    if (entry.kind != Kind::array)
+        return false;
+
+    vec<str> elements;
+    for (auto const& token: Array::tokens(split_assign(str(entry.text)).second)) {
+        if (Array::is_number(token))
+            return false;
+        elements.push_back(Array::unquote(token));
+    }
+    value = std::move(elements);
+    return true;
+}
+
+bool toml::read_value(Entry const& entry, vec<double>& value) {
+    if (entry.kind != Kind::array)
+        return false;
+
+    vec<double> elements;
+    for (auto const& token: Array::tokens(split_assign(str(entry.text)).second)) {
+        if (!Array::is_number(token))
+            return false;
+        elements.push_back(Number(token)._data);
+    }
+    value = std::move(elements);
+    return true;
+}
+
+Document toml::index(str const& data) {
+    Document document;
+    for_each_entry(data, [&document](Entry const& entry) {
+        if (entry.kind == Kind::header) {
+            if (std::find(document.tables.begin(), document.tables.end(), entry.table) == document.tables.end())
+                document.tables.push_back(str(entry.table));
+            return;
+        }
+        if (entry.kind == Kind::blank || entry.kind == Kind::other)
+            return;
+
+        str key = entry.table.empty() ? str(entry.key) : str(entry.table) + "." + str(entry.key);
+        document.values.try_emplace(key, Document::Value{entry.kind, str(entry.text), entry.line});
+    });
+    return document;
+}
+
+Entry Document::entry(Value const& value) {
+    return {value.kind, {}, {}, value.text, value.line};
+}
+
+bool Document::contains(str const& key) const {
+    if (values.count(key))
+        return true;
+    return std::any_of(tables.begin(), tables.end(), [&key](str const& table) {
+        return table == key || table.starts_with(key + ".");
+    });
+}
+
+std::optional<str> Document::text(str const& key) const {
+    auto found = values.find(key);
+    if (found == values.end())
+        return std::nullopt;
+    return split_assign(found->second.text).second;
+}
+
+vec<str> Document::subtables(str const& table) const {
+    vec<str> names;
+    for (auto const& header: tables) {
+        if (!header.starts_with(table + "."))
+            continue;
+        str name = header.substr(table.size() + 1);
+        if (name.find('.') == str::npos)
+            names.push_back(name);
+    }
+    return names;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+
+#include "toml.h"
+
+namespace toml {
+
+// a key of a table and the member it is read into
+template<class T, class V>
+struct Field {
+    const char* key;
+    V T::* member;
+};
+
+// the fields of a struct, declared once next to it:
+//   template<> struct toml::Schema<Lib> {
+//       static constexpr auto fields = std::tuple{Field{"url", &Lib::url}, ...};
+//   };
+// members can be str, double, vec<str>, vec<double> or an optional of them (nullopt when the
+// key is not assigned)
+template<class T>
+struct Schema;
+
+// a value that does not have the type of its member
+struct Error {
+    size_t line;
+    str key;            // table.key
+    str expected;       // "a string", "an array of strings", ...
+};
+
+std::ostream& operator<<(std::ostream& os, Error const& error);
+
+template<class T>
+struct Binding {
+    T value;
+    bool found = false;     // the document has the table
+    vec<Error> errors;
+};
+
+bool read_value(Entry const& entry, str& value);
+bool read_value(Entry const& entry, double& value);
+bool read_value(Entry const& entry, vec<str>& value);
+bool read_value(Entry const& entry, vec<double>& value);
+
+template<class V>
+bool read_value(Entry const& entry, std::optional<V>& value) {
+    V read;
+    if (!read_value(entry, read))
+        return false;
+    value = std::move(read);
+    return true;
+}
+
+template<class V> constexpr const char* type_name = "";
+template<> constexpr const char* type_name<str> = "a string";
+template<> constexpr const char* type_name<double> = "a number";
+template<> constexpr const char* type_name<vec<str>> = "an array of strings";
+template<> constexpr const char* type_name<vec<double>> = "an array of numbers";
+template<class V> constexpr const char* type_name<std::optional<V>> = type_name<V>;
+
+// reads the table (a header, "" for the root) of a document into a T, straight from the
+// lines: no Node is built. Like parse, the first assignment of a key is the one kept.
+template<class T>
+Binding<T> bind(std::string_view data, std::string_view table) {
+    constexpr auto& fields = Schema<T>::fields;
+    constexpr size_t count = std::tuple_size_v<std::decay_t<decltype(fields)>>;
+
+    Binding<T> binding{};
+    std::array<bool, count> assigned{};
+
+    auto assign = [&](Entry const& entry, auto const& field, bool& done) {
+        if (done)
+            return;
+        done = true;
+        if (!read_value(entry, binding.value.*field.member)) {
+            using V = std::decay_t<decltype(binding.value.*field.member)>;
+            binding.errors.push_back({entry.line, (table.empty() ? str() : str(table) + ".") + field.key, type_name<V>});
+        }
+    };
+
+    for_each_entry(data, [&](Entry const& entry) {
+        if (entry.table != table)
+            return;
+        binding.found = true;
+        if (entry.kind == Kind::header)
+            return;
+
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            ((entry.key == std::get<I>(fields).key && (assign(entry, std::get<I>(fields), assigned[I]), true)) || ...);
+        }(std::make_index_sequence<count>{});
+    });
+
+    return binding;
+}
+
+// the assignments of a document by key (table.key), from one pass over its lines: the typed
+// tables are bound from it and the keys only known at runtime (dependencies, query config)
+// read from it. No Node is built, the first assignment of a key is kept and the values are
+// read with read_value when asked for.
+struct Document {
+    struct Value {
+        Kind kind;
+        str text;           // the whole line
+        size_t line;
+    };
+    std::unordered_map<str, Value> values;
+    vec<str> tables;        // the headers, in the order of the document
+
+    // an assignment, a table or the parent of tables
+    bool contains(str const& key) const;
+
+    template<class V>
+    std::optional<V> get(str const& key) const {
+        auto found = values.find(key);
+        V value;
+        if (found == values.end() || !read_value(entry(found->second), value))
+            return std::nullopt;
+        return value;
+    }
+
+    // the value as written, nullopt for a missing key
+    std::optional<str> text(str const& key) const;
+
+    // the <name> of the [table.<name>] headers, in the order of the document
+    vec<str> subtables(str const& table) const;
+
+    static Entry entry(Value const& value);
+};
+
+Document index(str const& data);
+
+inline Document index(fs::path const& path) {
+    return index(read(path));
+}
+
+// reads the table of an indexed document into a T, the keys it does not assign keep the
+// values of base: binding the workspace, then the project over it, layers their settings
+template<class T>
+Binding<T> bind(Document const& document, str const& table, T const& base = {}) {
+    Binding<T> binding{base, table.empty() || document.contains(table), {}};
+    std::apply([&](auto const&... field) {
+        auto assign = [&](auto const& field) {
+            auto found = document.values.find(table.empty() ? str(field.key) : table + "." + field.key);
+            if (found == document.values.end())
+                return;
+            if (!read_value(Document::entry(found->second), binding.value.*field.member)) {
+                using V = std::decay_t<decltype(binding.value.*field.member)>;
+                binding.errors.push_back({found->second.line, found->first, type_name<V>});
+            }
+        };
+        (assign(field), ...);
+    }, Schema<T>::fields);
+    return binding;
+}
+
+}
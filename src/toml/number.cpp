@@ -13,13 +13,9 @@ bool Number::is(str type) {
     return type == "Number";
 }
 
-void Number::parse(str &line, sstr &&data, Table &root_table) {
-    std::regex re(ASSIGN);
-    std::sregex_token_iterator p(line.begin(), line.end(), re, -1);
-    str key = *p++;
-    str value = *p;
-
-    root_table.set_if_not(key, new Number(value));
+void Number::parse(str const& line, Table& table) {
+    auto [key, value] = split_assign(line);
+    table.set_if_not(key, new Number(value));
 }
 
 std::ostream& toml::operator<<(std::ostream& os, Number const& n) {
@@ -0,0 +1,228 @@
+#include "toml.h"
+
+#include <array>
+#include <span>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace toml;
+
+namespace {
+
+constexpr char STRUCTURALS[] = {'\n', '\r', '"', '\'', '[', ']', '=', '#', '\\'};
+
+constexpr std::array<bool, 256> structural_table() {
+    std::array<bool, 256> table{};
+    for (char c: STRUCTURALS)
+        table[(unsigned char)c] = true;
+    return table;
+}
+
+void scalar_index(std::string_view data, size_t from, vec<size_t>& index) {
+    static constexpr auto is_structural = structural_table();
+    for (size_t i = from; i < data.size(); i++)
+        if (is_structural[(unsigned char)data[i]])
+            index.push_back(i);
+}
+
+void push_mask(size_t base, uint32_t mask, vec<size_t>& index) {
+    while (mask) {
+        index.push_back(base + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+}
+
+#if defined(__x86_64__)
+// sse2 is part of x86-64, the blocks left are for the scalar loop
+size_t sse2_index(std::string_view data, vec<size_t>& index) {
+    size_t i = 0;
+    for (; i + 16 <= data.size(); i += 16) {
+        __m128i block = _mm_loadu_si128((__m128i const*)(data.data() + i));
+        __m128i found = _mm_setzero_si128();
+        for (char c: STRUCTURALS)
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+        push_mask(i, _mm_movemask_epi8(found), index);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t avx2_index(std::string_view data, vec<size_t>& index) {
+    size_t i = 0;
+    for (; i + 32 <= data.size(); i += 32) {
+        __m256i block = _mm256_loadu_si256((__m256i const*)(data.data() + i));
+        __m256i found = _mm256_setzero_si256();
+        for (char c: STRUCTURALS)
+            found = _mm256_or_si256(found, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+        push_mask(i, _mm256_movemask_epi8(found), index);
+    }
+    return i;
+}
+#endif
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool is_id_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool is_id(char c) {
+    return is_id_start(c) || is_digit(c);
+}
+
+// what may follow a value or a header: spaces, then the end of the line or a comment
+bool is_end(std::string_view text, size_t p) {
+    while (p < text.size() && text[p] == ' ')
+        p++;
+    return p == text.size() || text[p] == '#';
+}
+
+// a line with the positions (in the document) of its structural characters
+struct Line {
+    std::string_view text;
+    size_t offset;
+    std::span<const size_t> structurals;
+};
+
+Kind classify(Line const& line, std::string_view& header) {
+    std::string_view text = line.text;
+    for (size_t s: line.structurals)
+        if (text[s - line.offset] == '\r')
+            return Kind::other;
+
+    size_t p = text.find_first_not_of(' ');
+    if (p == str::npos)
+        return Kind::blank;
+
+    if (text[p] == '[') {
+        size_t key = p + 1;
+        if (key == text.size() || !is_id_start(text[key]))
+            return Kind::other;
+        size_t close = key + 1;
+        while (close < text.size() && (is_id(text[close]) || text[close] == '.'))
+            close++;
+        if (close == text.size() || text[close] != ']' || !is_end(text, close + 1))
+            return Kind::other;
+        header = text.substr(key, close - key);
+        return Kind::header;
+    }
+
+    if (!is_id_start(text[p]))
+        return Kind::other;
+    while (p < text.size() && is_id(text[p]))
+        p++;
+    while (p < text.size() && text[p] == ' ')
+        p++;
+    if (p == text.size() || text[p] != '=')
+        return Kind::other;
+    p = text.find_first_not_of(' ', p + 1);
+    if (p == str::npos)
+        return Kind::other;
+
+    char open = text[p];
+    if (is_digit(open)) {
+        while (p < text.size() && is_digit(text[p]))
+            p++;
+        return is_end(text, p) ? Kind::number : Kind::other;
+    }
+    if (open != '[' && open != '"' && open != '\'')
+        return Kind::other;
+
+    // the value ends at a closing delimiter followed by the end of the line or a comment,
+    // only the structural characters of the line can be one
+    char close = open == '[' ? ']' : open;
+    for (size_t s: line.structurals) {
+        size_t r = s - line.offset;
+        if (r >= p + 2 && text[r] == close && is_end(text, r + 1))
+            return open == '[' ? Kind::array : Kind::string;
+    }
+    return Kind::other;
+}
+
+}
+
+vec<size_t> toml::structural_index(std::string_view data) {
+    vec<size_t> index;
+    index.reserve(data.size() / 8);
+
+    size_t done = 0;
+#if defined(__x86_64__)
+    static bool const avx2 = __builtin_cpu_supports("avx2");
+    done = avx2 ? avx2_index(data, index) : sse2_index(data, index);
+#endif
+    scalar_index(data, done, index);
+    return index;
+}
+
+void toml::for_each_entry(std::string_view data, std::function<void(Entry const&)> f) {
+    vec<size_t> index = structural_index(data);
+
+    // the header of the last table, a blank line closes it
+    std::string_view table;
+
+    auto structural = index.begin();
+    size_t begin = 0;
+    for (size_t number = 1; begin < data.size(); number++) {
+        auto newline = std::find_if(structural, index.end(), [&](size_t p) { return data[p] == '\n'; });
+        size_t end = newline == index.end() ? data.size() : *newline;
+        Line line{data.substr(begin, end - begin), begin, {structural, newline}};
+
+        begin = end + 1;
+        structural = newline == index.end() ? newline : newline + 1;
+
+        std::string_view header;
+        Kind kind = classify(line, header);
+        if (kind == Kind::blank) {
+            table = {};
+            continue;
+        }
+        if (kind == Kind::other)
+            continue;
+
+        if (kind == Kind::header) {
+            // tables do not nest, a header before the blank line is ignored
+            if (!table.empty())
+                continue;
+            table = header;
+            f({kind, table, {}, line.text, number});
+            continue;
+        }
+
+        std::string_view key = line.text.substr(0, line.text.find('='));
+        key = key.substr(0, key.find_last_not_of(' ') + 1);
+        f({kind, table, key, line.text, number});
+    }
+}
+
+Table toml::parse(const str& data) {
+    Table root_table;
+    Table* section = &root_table;
+
+    for_each_entry(data, [&](Entry const& entry) {
+        if (entry.kind == Kind::header) {
+            section = Table::section(str(entry.table), root_table);
+            return;
+        }
+
+        Table& table = entry.table.empty() ? root_table : *section;
+        switch (entry.kind) {
+            case Kind::array:
+                Array::parse(str(entry.text), table);
+                break;
+            case Kind::number:
+                Number::parse(str(entry.text), table);
+                break;
+            case Kind::string:
+                String::parse(str(entry.text), table);
+                break;
+            default:
+                break;
+        }
+    });
+
+    return root_table;
+}
@@ -12,17 +12,16 @@ bool String::is(str type) {
     return type == "String";
 }
 
-void String::parse(str &line, sstr &&data, Table &root_table) {
-    std::regex re(ASSIGN);
-    std::sregex_token_iterator p(line.begin(), line.end(), re, -1);
-    str key = *p++;
-    str value = *p;
-
-    // TODO: change to remove only the bounding quotes (regex ?)
+str String::unquote(str value) {
+    // TODO: change to remove only the bounding quotes
     value.erase(std::remove(value.begin(), value.end(), '\"'), value.end());
     value.erase(std::remove(value.begin(), value.end(), '\''), value.end());
-    
-    root_table.set_if_not(key, new String(value));
+    return value;
+}
+
+void String::parse(str const& line, Table& table) {
+    auto [key, value] = split_assign(line);
+    table.set_if_not(key, new String(unquote(value)));
 }
 
 
@@ -164,53 +164,22 @@ std::ostream& toml::operator<<(std::ostream& os, Table* n) {
     return os;
 }
 
-void Table::parse(str &line, sstr &&data, Table &root_table) {
-    std::smatch matches;
-
-    // exctract maximum key from line to matches
-    {
-        std::regex re(TABLE_KEY);
-        std::regex_search(line, matches,re);
-    }
-
-    // create a new table in root_table with the maximum key (key.to.something)
-    str const& key = matches[0].str();
+Table* Table::section(str const& key, Table& root_table) {
     Table* t = root_table.value_or(key, new Table)->as<Table>();
 
     // create refrencing table (empty table containing only other tables)
-    {
-        auto const& keys = split(key, '.');
-        Table* parent_table = &root_table;
+    auto const& keys = split(key, '.');
+    Table* parent_table = &root_table;
 
-        for (size_t i=0; i<keys.size(); i++) {
-            str const& sub_key = keys[i];
+    for (size_t i=0; i<keys.size(); i++) {
+        str const& sub_key = keys[i];
 
-            if (i < keys.size() - 1) {
-                parent_table = parent_table->value_or(sub_key, new Table)->as<Table>();
-            }
-            else {
-                parent_table->set_if_not(sub_key, t);
-            }
+        if (i < keys.size() - 1) {
+            parent_table = parent_table->value_or(sub_key, new Table)->as<Table>();
         }
-
-    }
-
-    static map<str, std::function<void(str&, sstr&&, Table&)>> parse_map;
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"\\[.+\\]"  +END, Array::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"[0-9]+"    +END, Number::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"\".+\""    +END, String::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"'.+'"      +END, String::parse);
-
-    str field;
-    std::regex EOL("^ *$");
-    while (std::getline(data, field) && !std::regex_match(field, EOL)) {
-        for (auto& [k, v]: parse_map) {
-            std::regex pattern(k);
-            if (std::regex_match(field, pattern)) {
-                v(field, std::move(data), *t);
-                break;
-            }
+        else {
+            parent_table->set_if_not(sub_key, t);
         }
     }
+    return t;
 }
-
@@ -6,11 +6,13 @@
 #include <cstring>
 #include <fstream>
 #include <istream>
+#include <iterator>
 #include <regex>
 #include <iostream>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -28,11 +30,13 @@ using str = std::string;
 using cstr = const std::string;
 using sstr = std::stringstream;
 
-cstr BEGIN  = "^ *";
-cstr END    = " *(#.*)?$";
-cstr ID     = "[a-zA-Z_][a-zA-Z0-9_]*";
-cstr ASSIGN = " *= *";
-cstr TABLE_KEY = "[a-zA-Z_][a-zA-Z0-9_.]*";
+// splits "key = value" at the first '=', the key keeps the indentation of the line
+inline std::pair<str, str> split_assign(str const& line) {
+    size_t assign = line.find('=');
+    size_t key_end = line.find_last_not_of(' ', assign - 1) + 1;
+    size_t value_start = std::min(line.find_first_not_of(' ', assign + 1), line.size());
+    return {line.substr(0, key_end), line.substr(value_start)};
+}
 
 struct Node;
 struct String;
@@ -60,7 +64,8 @@ struct String: Node {
     str type();
     bool is(str type);
 
-    static void parse(str& line, sstr&& data, Table& root_table);
+    static void parse(str const& line, Table& table);
+    static str unquote(str value);
 
     friend std::ostream& operator<<(std::ostream& os, const String& n);
     friend std::ostream& operator<<(std::ostream& os, String* n);
@@ -74,7 +79,7 @@ struct Number: Node {
     str type();
     bool is(str type);
 
-    static void parse(str& line, sstr&& data, Table& root_table);
+    static void parse(str const& line, Table& table);
 
     friend std::ostream& operator<<(std::ostream& os, const Number& n);
     friend std::ostream& operator<<(std::ostream& os, Number* n);
@@ -91,7 +96,11 @@ struct Array: public Node {
     str type();
     bool is(str type);
 
-    static void parse(str& line, sstr&& data, Table& root_table);
+    static void parse(str const& line, Table& table);
+    // the elements of an array value, as written
+    static vec<str> tokens(str const& value);
+    static bool is_number(str const& token);
+    static str unquote(str const& token);
 
     friend std::ostream& operator<<(std::ostream& os, const Array& n);
     friend std::ostream& operator<<(std::ostream& os, Array* n);
@@ -116,46 +125,43 @@ struct Table: public Node {
     friend std::ostream& operator<<(std::ostream& os, const Table& n);
     friend std::ostream& operator<<(std::ostream& os, Table* n);
 
-    static void parse(str& line, sstr&& data, Table& root_table);
+    // the table of a [key] header, created with its parents
+    static Table* section(str const& key, Table& root_table);
 };
 
-inline Table parse(sstr&& data) {
-    static map<str, std::function<void(str&, sstr&&, Table&)>> parse_map;
-    parse_map.insert_or_assign(BEGIN+"\\["+TABLE_KEY+"\\]" +END, Table::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"\\[.+\\]"  +END, Array::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"[0-9]+"    +END, Number::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"\".+\""    +END, String::parse);
-    parse_map.insert_or_assign(BEGIN+ID+ASSIGN+"'.+'"      +END, String::parse);
-
-    Table root_table;
-
-    str line;
-    while(std::getline(data, line)) {
-        for (auto& [k, v]: parse_map) {
-            std::regex pattern(k);
-            if (std::regex_match(line, pattern)) {
-                v(line, std::move(data), root_table);
-                break;
-            }
-        }
-    }
+// positions of the structural characters of a document: '\n', '\r', '"', '\'', '[', ']', '=',
+// '#' and '\\'. They are found 32 (avx2) or 16 (sse2) bytes at a time, the instruction set is
+// picked at runtime and the scalar loop is the fallback.
+vec<size_t> structural_index(std::string_view data);
+
+// a header or an assignment of a document, in the table it belongs to. The parser only
+// knows [key.sub] headers and "key = value" assignments of arrays, numbers and quoted
+// strings, a blank line closes a table and the other lines are skipped.
+enum class Kind { blank, header, array, number, string, other };
+
+struct Entry {
+    Kind kind;
+    std::string_view table;     // the header of the table, "" at the root
+    std::string_view key;       // the assigned key, with the indentation of the line
+    std::string_view text;      // the whole line
+    size_t line;
+};
 
-    return root_table;
-}
+void for_each_entry(std::string_view data, std::function<void(Entry const&)> f);
 
-inline Table parse(fs::path path) {
-    auto fstr = std::ifstream(path);
-    sstr data;
-    data << fstr.rdbuf();
-    fstr.close();
-    return parse(std::move(data));
+// builds the document from the structural index
+Table parse(const str& data);
+
+inline Table parse(sstr&& data) {
+    return parse(data.str());
 }
 
-inline Table parse(const str& data) {
-    return parse(std::stringstream(data));
+inline str read(fs::path path) {
+    auto fstr = std::ifstream(path, std::ios::binary);
+    return str(std::istreambuf_iterator<char>(fstr), {});
 }
 
-inline Table parse(str&& data) {
-    return parse(std::stringstream(data));
+inline Table parse(fs::path path) {
+    return parse(read(path));
 }
 }
@@ -0,0 +1,178 @@
+#include "spear.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "worker.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+// the x86-64 micro architecture levels, best last
+static const strvec levels = {"x86-64", "x86-64-v2", "x86-64-v3", "x86-64-v4"};
+
+// execs <self>.d/<level> for the best level supported by the host cpu
+static string dispatcher_prgm =
+"#include <climits>\n"
+"#include <cpuid.h>\n"
+"#include <cstdio>\n"
+"#include <initializer_list>\n"
+"#include <string>\n"
+"#include <unistd.h>\n"
+"\n"
+"// the psABI levels, the compiler knows them from gcc 12 and clang 16. Before, every feature of\n"
+"// a level is read with cpuid, the avx state enabled by the os included.\n"
+"static bool supports(std::string const& level) {\n"
+"#if (defined(__clang__) && __clang_major__ >= 16) || (!defined(__clang__) && __GNUC__ >= 12)\n"
+"    if (level == \"x86-64-v4\") return __builtin_cpu_supports(\"x86-64-v4\");\n"
+"    if (level == \"x86-64-v3\") return __builtin_cpu_supports(\"x86-64-v3\");\n"
+"    if (level == \"x86-64-v2\") return __builtin_cpu_supports(\"x86-64-v2\");\n"
+"    return true;\n"
+"#else\n"
+"    unsigned a, b, c = 0, d, ext_c = 0, leaf7_b = 0, leaf7_c;\n"
+"    __get_cpuid(1, &a, &b, &c, &d);\n"
+"    __get_cpuid(0x80000001, &a, &b, &ext_c, &d);\n"
+"    __get_cpuid_count(7, 0, &a, &leaf7_b, &leaf7_c, &d);\n"
+"    unsigned xcr0 = 0, xcr0_high;\n"
+"    if (c >> 27 & 1)\n"
+"        __asm__(\"xgetbv\" : \"=a\"(xcr0), \"=d\"(xcr0_high) : \"c\"(0));\n"
+"\n"
+"    auto all = [](unsigned reg, std::initializer_list<int> bits) {\n"
+"        for (int bit: bits) {\n"
+"            if (!(reg >> bit & 1))\n"
+"                return false;\n"
+"        }\n"
+"        return true;\n"
+"    };\n"
+"    // cx16 popcnt sse3 sse4.1 sse4.2 ssse3, lahf\n"
+"    bool v2 = all(c, {13, 23, 0, 19, 20, 9}) && all(ext_c, {0});\n"
+"    // avx f16c fma movbe osxsave xsave, lzcnt, avx2 bmi1 bmi2\n"
+"    bool v3 = v2 && all(c, {28, 29, 12, 22, 27, 26}) && all(ext_c, {5}) && all(leaf7_b, {5, 3, 8})\n"
+"        && (xcr0 & 0x6) == 0x6;\n"
+"    // avx512f avx512bw avx512cd avx512dq avx512vl\n"
+"    bool v4 = v3 && all(leaf7_b, {16, 30, 28, 17, 31}) && (xcr0 & 0xe6) == 0xe6;\n"
+"\n"
+"    if (level == \"x86-64-v4\") return v4;\n"
+"    if (level == \"x86-64-v3\") return v3;\n"
+"    if (level == \"x86-64-v2\") return v2;\n"
+"    return true;\n"
+"#endif\n"
+"}\n"
+"\n"
+"int main(int argc, char* argv[]) {\n"
+"    char self[PATH_MAX];\n"
+"    ssize_t len = readlink(\"/proc/self/exe\", self, sizeof(self) - 1);\n"
+"    if (len < 0) {\n"
+"        perror(\"/proc/self/exe\");\n"
+"        return 127;\n"
+"    }\n"
+"    self[len] = 0;\n"
+"\n"
+"    __builtin_cpu_init();\n"
+"    for (const char* level: LEVELS) {\n"
+"        if (!supports(level))\n"
+"            continue;\n"
+"\n"
+"        std::string variant = std::string(self) + \".d/\" + level;\n"
+"        execv(variant.c_str(), argv);\n"
+"        perror(variant.c_str());\n"
+"        return 127;\n"
+"    }\n"
+"\n"
+"    fprintf(stderr, \"%s: no variant runs on this cpu\\n\", self);\n"
+"    return 127;\n"
+"}\n";
+
+static bool build_dispatcher(path const& target_dir, strvec const& targets) {
+    string level_list = "{";
+    for (auto itr = targets.rbegin(); itr != targets.rend(); itr++)
+        level_list += "\"" + *itr + "\", ";
+    level_list += "}";
+
+    string source = "#define LEVELS " + level_list + "\n" + dispatcher_prgm;
+    path source_file = target_dir / "dispatcher.cpp";
+    path dispatcher = target_dir / "build" / project_name;
+
+    // only touch the source when the levels changed, so the dispatcher is not rebuilt
+    std::ifstream previous(source_file);
+    if (string(std::istreambuf_iterator<char>(previous), {}) != source)
+        std::ofstream(source_file) << source;
+
+    strvec cmd = {cc, "-O2", "-std=c++20", "-o", dispatcher, source_file};
+    if (up_to_date(dispatcher, {source_file}, cmd))
+        return true;
+
+    if (!execute(cmd))
+        return false;
+    write_stamp(dispatcher, cmd);
+    return true;
+}
+
+bool build_variants(Profile const& profile) {
+    strvec targets;
+    for (auto const& level: levels) {
+        if (std::count(profile.targets.begin(), profile.targets.end(), level))
+            targets.push_back(level);
+    }
+
+    for (auto const& target: profile.targets) {
+        if (!std::count(levels.begin(), levels.end(), target)) {
+            std::cout << "Error: unknown target '" << target << "' in [profile." << profile.name << "]" << std::endl
+                      << "Supported targets are x86-64, x86-64-v2, x86-64-v3 and x86-64-v4" << std::endl;
+            return false;
+        }
+    }
+
+    path target_dir = make_target_dir(profile.name);
+    path variants_dir = target_dir / "build" / (project_name + ".d");
+    fs::create_directories(variants_dir);
+
+    // every level has its own object tree in target/<profile>/<level>/, the levels are
+    // built at the same time and share the job slots and the memory budget
+    jobs = std::max<size_t>(1, jobs / targets.size());
+    size_t budget = memory_budget();
+    size_t share = budget > 0 ? std::max<size_t>(1, budget / targets.size()) : 0;
+    worker::probe();
+    std::cout << std::flush;
+
+    vector<pid_t> builds;
+    for (auto const& level: targets) {
+        Profile variant = profile;
+        variant.name = profile.name + "/" + level;
+        variant.options.push_back("-march=" + level);
+        variant.targets.clear();
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            memory_share = share;
+            exit(build_profile(variant, variants_dir / level) ? 0 : 1);
+        }
+        builds.push_back(pid);
+    }
+
+    bool success = true;
+    for (pid_t pid: builds) {
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            success = false;
+    }
+
+    if (!success) {
+        std::cout << "Error: a variant of " << project_name << " failed to build" << std::endl;
+        return false;
+    }
+
+    std::cout << "DISPATCHER" << std::endl;
+    return build_dispatcher(target_dir, targets);
+}
@@ -0,0 +1,466 @@
+#include "worker.h"
+
+#include <atomic>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <regex>
+#include <semaphore>
+#include <sstream>
+#include <thread>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "man.h"
+#include "runner.h"
+#include "spear.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+extern size_t cli_jobs;
+
+namespace worker {
+
+static string read_file(path const& file) {
+    std::ifstream in(file, std::ios::binary);
+    return string(std::istreambuf_iterator<char>(in), {});
+}
+
+static bool send_all(int fd, string const& data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t size = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (size <= 0)
+            return false;
+        sent += size;
+    }
+    return true;
+}
+
+static bool recv_line(int fd, string& line) {
+    line.clear();
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (c == '\n')
+            return true;
+        line += c;
+    }
+    return false;
+}
+
+static bool recv_exact(int fd, size_t size, string& data) {
+    data.resize(size);
+    for (size_t received = 0; received < size;) {
+        ssize_t chunk = recv(fd, data.data() + received, size - received, 0);
+        if (chunk <= 0)
+            return false;
+        received += chunk;
+    }
+    return true;
+}
+
+// a connection to host:port, -1 when it does not answer within timeout seconds. A compile
+// waits for its answer as long as it takes, a load request does not (receive_timeout)
+static int connect_to(string const& address, int timeout, bool receive_timeout) {
+    size_t colon = address.find_last_of(':');
+    if (colon == string::npos)
+        return -1;
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+        return -1;
+
+    int fd = -1;
+    for (addrinfo* info = found; info; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        timeval time{timeout, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &time, sizeof(time));
+        if (receive_timeout)
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time));
+        if (connect(fd, info->ai_addr, info->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+struct Load {
+    size_t busy;    // compiles running or waiting for a slot
+    size_t slots;
+};
+
+static std::optional<Load> load(string const& address) {
+    int fd = connect_to(address, 2, true);
+    if (fd < 0)
+        return std::nullopt;
+
+    string line;
+    std::optional<Load> load;
+    if (send_all(fd, "load\n") && recv_line(fd, line)) {
+        std::stringstream answer(line);
+        string word;
+        Load value{};
+        if (answer >> word >> value.busy >> value.slots && word == "load" && value.slots > 0)
+            load = value;
+    }
+    close(fd);
+    return load;
+}
+
+static std::optional<vector<Host>> hosts;
+
+void probe() {
+    if (hosts)
+        return;
+
+    hosts.emplace();
+    strvec const& addresses = settings.distributed.workers;
+    if (!addresses.empty() && spear_executable().empty()) {
+        std::cout << "Warning: spear is not in PATH, the units compile locally instead of on the workers" << std::endl;
+        return;
+    }
+    for (auto const& address: addresses) {
+        if (auto answer = load(address))
+            hosts->push_back({address, answer->slots});
+        else
+            std::cout << "Warning: worker " << address << " is unreachable" << std::endl;
+    }
+}
+
+vector<Host> const& reachable() {
+    static const vector<Host> none;
+    return hosts ? *hosts : none;
+}
+
+// the flags only the local preprocessing reads, with the ones taking their value apart
+static bool is_preprocessor_flag(string const& arg, bool& takes_value) {
+    static const strvec flags = {"-I", "-D", "-U", "-iquote", "-isystem", "-idirafter", "-include", "-imacros"};
+    for (auto const& flag: flags) {
+        if (arg.starts_with(flag)) {
+            takes_value = arg == flag;
+            return true;
+        }
+    }
+    return false;
+}
+
+static strvec compile_flags(strvec const& flags) {
+    strvec kept;
+    for (size_t i = 0; i < flags.size(); i++) {
+        bool takes_value = false;
+        if (is_preprocessor_flag(flags[i], takes_value))
+            i += takes_value;
+        else
+            kept.push_back(flags[i]);
+    }
+    return kept;
+}
+
+// a worker runs the code generation flags of a preprocessed unit and nothing that loads
+// code or names files outside of its unit directory (-fplugin, -wrapper, -B, -specs, @file,
+// -o, -Wl, ...). Options writing a file take a name without directory. The prefix maps
+// (-ffile-prefix-map=<root>=. with a cache) only rewrite the paths of the debug info.
+static bool accepted(string const& flag) {
+    static const std::regex code_generation("-(c|w|pipe|pthread|pedantic|pedantic-errors|std=.+|O.*|g.*|m[^/]+|W[^,]*|f[^=]+(=[^/|@]*)?)");
+    static const std::regex prefix_map("-f(file|debug|macro)-prefix-map=[^=]+=.*");
+    static const strvec loading = {"-fplugin", "-fmodule", "-fprofile", "-fauto-profile", "-fdiagnostics-plugin"};
+    if (std::regex_match(flag, prefix_map))
+        return true;
+    if (!std::regex_match(flag, code_generation) || flag.starts_with("-Wl") || flag.starts_with("-Wa") || flag.starts_with("-Wp"))
+        return false;
+    return std::none_of(loading.begin(), loading.end(), [&flag](string const& prefix) { return flag.starts_with(prefix); });
+}
+
+// the flags a worker gets, -x apart as its value is checked, are all accepted
+static bool accepted(strvec const& flags) {
+    for (size_t i = 0; i < flags.size(); i++) {
+        if (flags[i] == "-x" && i + 1 < flags.size() && (flags[i + 1] == "c-cpp-output" || flags[i + 1] == "c++-cpp-output"))
+            i++;
+        else if (!accepted(flags[i]))
+            return false;
+    }
+    return true;
+}
+
+bool distributable(strvec const& args, bool uses_modules) {
+    if (uses_modules || has_split_dwarf(args) || args.size() < 4)
+        return false;
+
+    // the compiler, -o <object> and the source apart
+    strvec flags;
+    for (size_t i = 1; i + 1 < args.size(); i++) {
+        if (args[i] == "-o")
+            i++;
+        else
+            flags.push_back(args[i]);
+    }
+    return accepted(compile_flags(flags));
+}
+
+strvec command(strvec const& args) {
+    string hosts;
+    for (auto const& host: reachable())
+        hosts += (hosts.empty() ? "" : ",") + host.address;
+
+    strvec cmd = {spear_executable(), "worker", "compile", hosts};
+    cmd.insert(cmd.end(), args.begin(), args.end());
+    return cmd;
+}
+
+// a worker drawn with a weight of its free slots, compiles starting together would all see
+// the same loads and go to the same worker otherwise. When they are all busy, the one with
+// the shortest queue per slot.
+static std::optional<string> pick(strvec const& hosts) {
+    vector<std::pair<string, Load>> loads;
+    for (auto const& host: hosts) {
+        if (auto answer = load(host))
+            loads.push_back({host, *answer});
+    }
+    if (loads.empty())
+        return std::nullopt;
+
+    size_t free_slots = 0;
+    for (auto const& [host, load]: loads)
+        free_slots += load.slots > load.busy ? load.slots - load.busy : 0;
+
+    if (free_slots == 0) {
+        auto least = std::min_element(loads.begin(), loads.end(), [](auto const& a, auto const& b) {
+            return a.second.busy * b.second.slots < b.second.busy * a.second.slots;
+        });
+        return least->first;
+    }
+
+    static std::mt19937 random(std::random_device{}());
+    size_t draw = std::uniform_int_distribution<size_t>(0, free_slots - 1)(random);
+    for (auto const& [host, load]: loads) {
+        size_t free = load.slots > load.busy ? load.slots - load.busy : 0;
+        if (draw < free)
+            return host;
+        draw -= free;
+    }
+    return loads.back().first;
+}
+
+// sends the unit to host, writes the object on success. The exit code of the remote
+// compiler, nullopt when the worker could not run it (connection, refused flags, no compiler).
+static std::optional<int> compile_on(string const& host, strvec const& args, string const& source, string const& preprocessed, path const& object) {
+    int fd = connect_to(host, 2, false);
+    if (fd < 0)
+        return std::nullopt;
+
+    string request = "compile " + std::to_string(args.size()) + " " + std::to_string(preprocessed.size()) + "\n"
+        + fs::current_path().string() + "\n" + source + "\n";
+    for (auto const& arg: args)
+        request += arg + "\n";
+
+    string line;
+    bool done = send_all(fd, request) && send_all(fd, preprocessed) && recv_line(fd, line);
+
+    std::stringstream answer(line);
+    string word;
+    int code = -1;
+    size_t output_size = 0, artifact_size = 0;
+    string output, artifact;
+    done = done && answer >> word >> code >> output_size >> artifact_size && word == "exit"
+        && recv_exact(fd, output_size, output) && recv_exact(fd, artifact_size, artifact);
+    close(fd);
+    if (!done || code == 126 || code == 127)
+        return std::nullopt;
+
+    if (code == 0) {
+        path artifact_file = object;
+        artifact_file += ".remote";
+        std::ofstream(artifact_file, std::ios::binary) << artifact;
+        bool restored = cache::restore(artifact_file, {object});
+        fs::remove(artifact_file);
+        if (!restored)
+            return std::nullopt;
+    }
+
+    std::cout << "REMOTE " << host << "\n" << output << std::flush;
+    return code;
+}
+
+int compile(strvec const& hosts, strvec const& args) {
+    auto output = std::find(args.begin(), args.end(), "-o");
+    if (hosts.empty() || output == args.end() || output + 1 >= args.end() - 1)
+        return runner::retry_locally;
+
+    path object = *(output + 1);
+    string source = args.back();
+
+    // the compile flags without the output and the source
+    strvec flags(args.begin(), output);
+    flags.insert(flags.end(), output + 2, args.end() - 1);
+
+    path preprocessed_file = object;
+    preprocessed_file += ".ii";
+    strvec preprocess = flags;
+    std::replace(preprocess.begin(), preprocess.end(), string("-c"), string("-E"));
+    preprocess.insert(preprocess.end(), {"-o", preprocessed_file, source});
+
+    auto process = runner::spawn(preprocess, runner::Output::capture);
+    if (!process || runner::wait(*process) != 0) {
+        fs::remove(preprocessed_file);
+        return runner::retry_locally;
+    }
+    string preprocessed = read_file(preprocessed_file);
+    fs::remove(preprocessed_file);
+
+    strvec sent = {flags[0]};
+    strvec code_flags = compile_flags(strvec(flags.begin() + 1, flags.end()));
+    sent.insert(sent.end(), code_flags.begin(), code_flags.end());
+    sent.insert(sent.end(), {"-x", path(source).extension() == ".c" ? "c-cpp-output" : "c++-cpp-output"});
+
+    // the errors of the remote compiler are the ones of the unit, only a unit no worker could
+    // compile (gone, refused) runs again as a local job
+    auto host = pick(hosts);
+    if (!host) {
+        std::cout << "Warning: no worker answered, compiling " << source << " locally" << std::endl;
+        return runner::retry_locally;
+    }
+    auto code = compile_on(*host, sent, source, preprocessed, object);
+    if (!code) {
+        std::cout << "Warning: worker " << *host << " could not compile " << source << ", compiling it locally" << std::endl;
+        return runner::retry_locally;
+    }
+    return *code == runner::retry_locally ? 1 : *code;
+}
+
+static std::atomic<size_t> busy = 0;
+static std::atomic<size_t> next_unit = 0;
+static std::mutex log_mutex;
+
+// only a compiler runs on a worker, not any command a client sends
+static bool is_compiler(string const& cmd) {
+    static const std::regex compilers("(gcc|g\\+\\+|cc|c\\+\\+|clang|clang\\+\\+)(-[0-9.]+)?");
+    return std::regex_match(cmd, compilers);
+}
+
+static void handle(int client, std::counting_semaphore<>& free_slots, size_t slots) {
+    string line;
+    if (!recv_line(client, line))
+        return;
+
+    std::stringstream request(line);
+    string word;
+    size_t arg_count = 0, size = 0;
+    request >> word;
+    if (word == "load") {
+        send_all(client, "load " + std::to_string(busy) + " " + std::to_string(slots) + "\n");
+        return;
+    }
+    if (word != "compile" || !(request >> arg_count >> size))
+        return;
+
+    string dir, source, preprocessed;
+    strvec args(arg_count);
+    bool received = recv_line(client, dir) && recv_line(client, source);
+    for (auto& arg: args)
+        received = received && recv_line(client, arg);
+    if (!received || !recv_exact(client, size, preprocessed))
+        return;
+
+    if (args.empty() || !is_compiler(args[0]) || !accepted(strvec(args.begin() + 1, args.end()))) {
+        string output = args.empty() || !is_compiler(args[0])
+            ? "Error: " + (args.empty() ? string() : args[0]) + " is not a compiler\n"
+            : "Error: the worker does not run these flags\n";
+        send_all(client, "exit 126 " + std::to_string(output.size()) + " 0\n" + output);
+        return;
+    }
+
+    busy++;
+    free_slots.acquire();
+
+    path unit_dir = fs::temp_directory_path() / "spear-worker" / (std::to_string(getpid()) + "-" + std::to_string(next_unit++));
+    fs::create_directories(unit_dir);
+    std::ofstream(unit_dir / "unit.ii", std::ios::binary) << preprocessed;
+
+    // the debug info names the client directory, not the one of the worker
+    args.push_back("-fdebug-prefix-map=" + unit_dir.string() + "=" + dir);
+    args.insert(args.end(), {"unit.ii", "-o", "unit.o"});
+
+    int code = 127;
+    string output, artifact;
+    if (auto process = runner::spawn(args, runner::Output::capture, unit_dir)) {
+        code = runner::wait(*process);
+        output = process->output;
+    }
+    if (code == 0 && cache::pack({unit_dir / "unit.o"}, unit_dir / "unit.artifact"))
+        artifact = read_file(unit_dir / "unit.artifact");
+    else if (code == 0)
+        code = 1;
+    fs::remove_all(unit_dir);
+
+    free_slots.release();
+    busy--;
+
+    send_all(client, "exit " + std::to_string(code) + " " + std::to_string(output.size()) + " "
+        + std::to_string(artifact.size()) + "\n" + output + artifact);
+
+    std::lock_guard lock(log_mutex);
+    std::cout << source << " exit " << code << std::endl;
+}
+
+void serve(string const& address, int port, size_t slots) {
+    int server = cache::listen_socket(address, port);
+    if (server < 0) {
+        perror("spear worker");
+        return;
+    }
+
+    std::cout << "compiling on " << address << " port " << port << " with " << slots << " slots" << std::endl;
+    signal(SIGPIPE, SIG_IGN);
+    std::counting_semaphore<> free_slots(slots);
+    while (true) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0)
+            continue;
+        std::thread([client, &free_slots, slots]() {
+            handle(client, free_slots, slots);
+            close(client);
+        }).detach();
+    }
+}
+
+}
+
+void worker_command(const int argc, char* argv[]) {
+    CHECK((argc < 2), man::worker)
+    string mode = argv[1];
+
+    if (mode == "compile" && argc >= 4) {
+        strvec hosts;
+        std::stringstream list(argv[2]);
+        for (string host; getline(list, host, ',');)
+            hosts.push_back(host);
+        exit(worker::compile(hosts, strvec(argv + 3, argv + argc)));
+    }
+
+    CHECK((mode != "--listen"), man::worker)
+    auto address = cache::listen_address(argc > 2 ? argv[2] : "", 8091);
+    CHECK((!address), man::worker)
+
+    size_t slots = cli_jobs ? cli_jobs : std::max(1u, std::thread::hardware_concurrency());
+    worker::serve(address->first, address->second, slots);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// distributed compilation: `spear worker --listen` compiles the preprocessed units other
+// spear processes send it. Configured by [distributed] workers in spear.toml or the global
+// spear.toml, a worker runs the compile flags it receives so it belongs on a trusted network.
+namespace worker {
+
+struct Host {
+    std::string address;    // host:port
+    size_t slots;           // compiles it runs at once
+};
+
+// asks the [distributed] workers for their slots, once per spear run. The builds call it
+// before planning (and before the variants fork) as an unreachable worker blocks for 2s.
+void probe();
+
+// the workers that answered probe(), none before it ran
+std::vector<Host> const& reachable();
+
+// modules need their interfaces next to the compiler and split dwarf objects name their .dwo
+// by its local path, those units compile locally, as do the ones with flags a worker refuses
+bool distributable(std::vector<std::string> const& args, bool uses_modules);
+
+// the job command compiling args on the least loaded worker: spear itself, in compile mode
+std::vector<std::string> command(std::vector<std::string> const& args);
+
+// preprocesses locally, compiles on a worker and writes the object. Returns the exit code of
+// the compile, runner::retry_locally when no worker could do it.
+int compile(std::vector<std::string> const& hosts, std::vector<std::string> const& args);
+
+// listens on address (localhost unless one is given) and port
+void serve(std::string const& address, int port, size_t slots);
+
+}
@@ -0,0 +1,110 @@
+#include "spear.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "runner.h"
+#include "worker.h"
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using strvec = vector<string>;
+using path = fs::path;
+
+// the project globals of a member, loaded once and swapped in when the member is built
+struct Member {
+    path root;
+    toml::Document config;
+    Settings settings;
+    string name;
+    string cc;
+    path target_root;
+    std::optional<Profile> profile;
+    std::shared_ptr<CompilePlan> plan;
+};
+
+static void use_member(Member const& member) {
+    root = member.root;
+    project_config = member.config;
+    settings = member.settings;
+    project_name = member.name;
+    cc = member.cc;
+    target_root = member.target_root;
+}
+
+bool build_workspace(string const& name) {
+    path workspace = root;
+    Member workspace_state{root, project_config, settings, project_name, cc, target_root, std::nullopt, nullptr};
+
+    // every member compiles in the same pool, with the jobs, memory and workers of the
+    // workspace: the members loaded below replace the project settings
+    runner::JobPool pool(jobs, memory_budget());
+    worker::probe();
+
+    vector<Member> members;
+    for (auto const& member_dir: workspace_state.settings.workspace.members) {
+        if (!fs::exists(workspace / member_dir / "spear.toml")) {
+            std::cout << "Error: workspace member " << member_dir << " has no spear.toml" << std::endl;
+            use_member(workspace_state);
+            return false;
+        }
+
+        load_project(workspace / member_dir);
+        members.push_back({root, project_config, settings, project_name, cc, target_root, find_profile(name), nullptr});
+        if (!members.back().profile && name != "pgo") {
+            std::cout << "Error: unknown profile '" << name << "' in " << project_name << std::endl;
+            use_member(workspace_state);
+            return false;
+        }
+    }
+
+    // a member without changes adds no job
+    std::cout << "BUILDING " << members.size() << " members" << std::endl;
+    for (auto& member: members) {
+        if (name == "pgo" || !member.profile->targets.empty())
+            continue;
+
+        use_member(member);
+        path target_dir = make_target_dir(member.profile->name);
+        member.plan = plan_compile(pool, root / "src", target_dir / "object", profile_args(*member.profile), target_dir / "bmi");
+    }
+    bool success = pool.run();
+
+    vector<string> failed;
+    for (auto& member: members) {
+        use_member(member);
+
+        // pgo and multi versioned builds run their own builds, one member at a time
+        if (!member.plan) {
+            if (!build_named(name))
+                failed.push_back(member.name);
+            continue;
+        }
+
+        auto objects = finish_compile(*member.plan, success);
+        if (!objects)
+            continue;
+
+        path target_dir = target_root / member.profile->name;
+        std::cout << "LINKING " << member.name << std::endl;
+        if (!link_objects(target_dir / "object", *objects, target_dir / "build" / member.name, member.profile->link_options))
+            failed.push_back(member.name);
+    }
+
+    use_member(workspace_state);
+    if (!success) {
+        std::cout << "Error: could not build the workspace" << std::endl;
+        return false;
+    }
+    if (!failed.empty()) {
+        std::cout << "Error: could not link";
+        for (auto const& member: failed)
+            std::cout << " " << member;
+        std::cout << std::endl;
+        return false;
+    }
+    return true;
+}